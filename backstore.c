@@ -8,86 +8,191 @@
 #include "fs.h"
 #include "buf.h"
 #include "backstore.h"
-void backstore_init() {
+#include "vmstat.h"
+
+#define MAXSLOTS (1 << (32 - PTXSHIFT))  // what a PTE can name
+
+struct backstore backstore;
+
+// Swap I/O goes straight between the frame and the disk through
+// these bufs, which are not part of the buffer cache, so paging
+// never pushes file system blocks out of it.
+static struct {
+    struct spinlock lock;
+    struct buf      buf[NSWAPBUF];  // refcnt is 1 while in use
+} swapbuf;
+
+// Look for a swap area on each disk, set up a slot table for all
+// of them at vstart, and thread each area's slots onto its free
+// list.  A free list is a stack through next_index, so recently
+// freed slots are reused first.  Runs at boot, before kinit2()
+// hands out the memory at vstart.  Returns the first address past
+// the table.
+char *backstore_init(char *vstart) {
+    struct superblock sb;
+    struct swaparea  *a;
+    uchar             data[BSIZE];
+    uint              dev, i, n;
     initlock(&backstore.lock, "backstore");
-    for (int i = 0; i < BACKSTORE_SIZE / 8; i++) {
-        backstore.backstore_bitmap[i].va = -1;
-    }
-}
-int store_page(struct proc *currproc, uint va) {
-    uint            block_no;
-    struct buf *    frame;
-    int             i, j;
-    int             current_index;
-    struct backstore_frame *temp = currproc->blist;
-    struct backstore_frame *prev = temp;
-    if (currproc->blist == 0) {
-        if ((block_no = get_free_block()) == -1) { return -1; }
-        currproc->blist = &(
-                backstore.backstore_bitmap[(block_no - BACKSTORE_START) / 8]);
-        acquire(&backstore.lock);
-        currproc->blist->va         = va;
-        currproc->blist->next_index = -1;
-        release(&backstore.lock);
-        for (j = 0; j < 8; j++) {
-            frame = bget(ROOTDEV, block_no + j);
-            memmove(frame->data, currproc->buf + BSIZE * j, BSIZE);
-            bwrite(frame);
-            brelse(frame);
+    initlock(&swapbuf.lock, "swapbuf");
+    for (i = 0; i < NSWAPBUF; i++) initsleeplock(&swapbuf.buf[i].lock, "swapbuf");
+    backstore.backstore_bitmap = (struct backstore_frame *)vstart;
+    for (dev = 0; dev < NSWAPDEV; dev++) {
+        if (diskread(dev, 1, data) < 0) continue;
+        memmove(&sb, data, sizeof(sb));
+        if (sb.swapmagic != SWAPMAGIC) continue;
+        n = sb.nswap / (PGSIZE / BSIZE);
+        if (n > MAXSLOTS - backstore.nslots) n = MAXSLOTS - backstore.nslots;
+        if (n == 0) continue;
+        a         = &backstore.area[backstore.narea++];
+        a->dev    = dev;
+        a->start  = sb.swapstart;
+        a->base   = backstore.nslots;
+        a->nslots = n;
+        for (i = a->base; i < a->base + a->nslots; i++) {
+            backstore.backstore_bitmap[i].next_index = i + 1;
+            backstore.backstore_bitmap[i].ref        = 0;
         }
-        return 1;
+        backstore.backstore_bitmap[i - 1].next_index = -1;
+        a->freelist = a->base;
+        a->nfree    = a->nslots;
+        backstore.nslots += a->nslots;
+        backstore.nfree += a->nslots;
+        cprintf("swap: %d slots on disk %d at block %d\n", a->nslots, dev, a->start);
     }
-    while (1) {
-        if ((uint)temp->va == va) {
-            current_index = ((uint)temp - (uint)(backstore.backstore_bitmap))
-                            / sizeof(struct backstore_frame);
-            block_no = BACKSTORE_START + current_index * 8;
-            for (j = 0; j < 8; j++) {
-                frame = bget(ROOTDEV, block_no + j);
-                memmove(frame->data, currproc->buf + BSIZE * j, BSIZE);
-                bwrite(frame);
-                brelse(frame);
-            }
-            return 1;
+    return (char *)PGROUNDUP((uint)(backstore.backstore_bitmap + backstore.nslots));
+}
+// The area holding a slot.
+static struct swaparea *slot_area(uint slot) {
+    struct swaparea *a;
+    for (a = backstore.area; a < backstore.area + backstore.narea; a++)
+        if (slot - a->base < a->nslots) return a;
+    panic("slot_area");
+}
+// Take a slot off the free list of the next area in turn that has
+// one, so that consecutive page-outs are spread over the disks.
+// Returns the slot, or -1 if the backstore is full.
+uint backstore_alloc(void) {
+    struct swaparea *a;
+    uint             i;
+    int              n;
+    acquire(&backstore.lock);
+    for (n = 0; n < backstore.narea; n++) {
+        a = &backstore.area[backstore.next];
+        backstore.next = (backstore.next + 1) % backstore.narea;
+        if ((i = a->freelist) != -1) {
+            a->freelist = backstore.backstore_bitmap[i].next_index;
+            a->nfree--;
+            backstore.nfree--;
+            backstore.backstore_bitmap[i].next_index = -1;
+            backstore.backstore_bitmap[i].ref        = 1;
+            release(&backstore.lock);
+            return i;
         }
-        if (temp->next_index == -1) { break; }
-        prev = temp;
-        temp = &(backstore.backstore_bitmap[temp->next_index]);
     }
-    if ((block_no = get_free_block()) == -1) { return -1; }
+    release(&backstore.lock);
+    return -1;
+}
+// Take another reference to an allocated slot.
+void backstore_share(uint slot) {
+    if (slot >= backstore.nslots) panic("backstore_share");
     acquire(&backstore.lock);
-    backstore.backstore_bitmap[(block_no - BACKSTORE_START) / 8].va = va;
-    backstore.backstore_bitmap[(block_no - BACKSTORE_START) / 8].next_index = -1;
+    if (backstore.backstore_bitmap[slot].ref == 0) panic("backstore_share");
+    backstore.backstore_bitmap[slot].ref++;
     release(&backstore.lock);
-    prev->next_index = (block_no - BACKSTORE_START) / 8;
-    for (i = 0; i < 8; i++) {
-        frame = bget(ROOTDEV, block_no + i);
-        memmove(frame->data, (currproc->buf) + BSIZE * i, BSIZE);
-        bwrite(frame);
-        brelse(frame);
+}
+// Number of references to a slot.
+uint backstore_refcount(uint slot) {
+    return backstore.backstore_bitmap[slot].ref;
+}
+// Drop a reference to a slot, putting it back on the free list
+// when the last one goes.
+void backstore_free(uint slot) {
+    struct swaparea *a;
+    if (slot >= backstore.nslots) panic("backstore_free");
+    acquire(&backstore.lock);
+    if (backstore.backstore_bitmap[slot].ref == 0) panic("backstore_free");
+    if (--backstore.backstore_bitmap[slot].ref > 0) {
+        release(&backstore.lock);
+        return;
     }
-    return 1;
+    zswap_drop(slot);
+    a = slot_area(slot);
+    backstore.backstore_bitmap[slot].next_index = a->freelist;
+    a->freelist = slot;
+    a->nfree++;
+    backstore.nfree++;
+    release(&backstore.lock);
 }
-uint get_free_block() {
-    int i;
-    for (i = 0; i < BACKSTORE_SIZE / 8; i++) {
-        if (backstore.backstore_bitmap[i].va == -1)
-            return (BACKSTORE_START + i * 8);
+// Take a free swap buf, waiting for one if need be, and set it
+// up to move the page at mem to or from a slot.  Returns it locked.
+static struct buf *swap_getbuf(uint slot, char *mem, int write) {
+    struct swaparea *a;
+    struct buf      *b;
+    acquire(&swapbuf.lock);
+    for (;;) {
+        for (b = swapbuf.buf; b < swapbuf.buf + NSWAPBUF; b++)
+            if (b->refcnt == 0) break;
+        if (b < swapbuf.buf + NSWAPBUF) break;
+        sleep(&swapbuf, &swapbuf.lock);
     }
-    return -1;
+    b->refcnt = 1;
+    release(&swapbuf.lock);
+
+    a = slot_area(slot);
+    acquiresleep(&b->lock);
+    b->dev     = a->dev;
+    b->blockno = a->start + (slot - a->base) * (PGSIZE / BSIZE);
+    b->flags   = write ? B_DIRTY : 0;
+    b->mnext   = 0;
+    b->page    = (uchar *)mem;
+    b->done    = 0;
+    return b;
+}
+// Give back a swap buf once its request is done.  Also called
+// from the disk interrupt handler, as the buf's done function.
+static void swap_putbuf(struct buf *b) {
+    b->page = 0;
+    b->done = 0;
+    releasesleep(&b->lock);
+
+    acquire(&swapbuf.lock);
+    b->refcnt = 0;
+    wakeup(&swapbuf);
+    release(&swapbuf.lock);
 }
-void free_backstore(struct proc *curproc) {
-    struct backstore_frame *temp = curproc->blist;
-    struct backstore_frame *prev = temp;
-    if (temp == 0) return;
+// Move the page at mem to or from a slot in one disk request.
+static void swap_rw(uint slot, char *mem, int write) {
+    struct buf *b;
+    b = swap_getbuf(slot, mem, write);
+    diskrw(b);
+    swap_putbuf(b);
+}
+// Write the page at src to a slot: into the compressed pool if
+// it takes the page, otherwise to disk.
+void backstore_write(uint slot, char *src) {
+    if (zswap_store(slot, src) == 0) return;
+    swap_rw(slot, src, 1);
+}
+// Read a slot into the page at dst, from the compressed pool if
+// it is there, otherwise from disk.
+void backstore_read(uint slot, char *dst) {
+    if (zswap_load(slot, dst) == 0) return;
+    swap_rw(slot, dst, 0);
+}
+// Start reading a slot into the page at dst as part of batch bb;
+// the page is ready once bwait(bb) returns.  Reads from the
+// compressed pool are done at once.
+void backstore_read_async(uint slot, char *dst, struct biobatch *bb) {
+    struct buf *b;
+    if (zswap_load(slot, dst) == 0) return;
+    b       = swap_getbuf(slot, dst, 0);
+    b->done = swap_putbuf;
+    bsubmit(bb, b);
+}
+void backstore_stat(struct vmstat *st) {
     acquire(&backstore.lock);
-    while (temp->next_index != -1) {
-        temp->va         = -1;
-        prev             = temp;
-        temp             = &(backstore.backstore_bitmap[temp->next_index]);
-        prev->next_index = -1;
-    }
-    temp->va = -1;
+    st->swap_total = backstore.nslots;
+    st->swap_free  = backstore.nfree;
     release(&backstore.lock);
-    return;
 }
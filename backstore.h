@@ -1,8 +1,28 @@
+// One entry per page-sized slot of the backstore.  Which slot
+// holds a swapped-out page is recorded in that page's PTE (see
+// PTE_SWAP); free slots are linked through next_index.  A slot
+// can be named by the PTEs of several processes after fork.
 struct backstore_frame{
-    int va;
     uint next_index;
+    uint ref;  // PTEs naming this slot
 };
-struct{
+// A swap area, as laid out by mkfs on one disk.  The slots of all
+// areas are numbered consecutively; this one's start at base.
+struct swaparea{
+    uint dev;
+    uint start;     // first block of the area on dev
+    uint base;      // first slot of the area
+    uint nslots;    // slots in the area
+    uint freelist;  // first free slot of the area, -1 if full
+    uint nfree;     // free slots in the area
+};
+struct backstore{
     struct spinlock lock;
-    struct backstore_frame backstore_bitmap[BACKSTORE_SIZE/8];
-} backstore;
+    uint nfree;     // number of free slots
+    uint nslots;    // slots in all areas
+    int narea;
+    int next;       // area the next slot is taken from
+    struct swaparea area[NSWAPDEV];
+    struct backstore_frame *backstore_bitmap;  // nslots entries
+};
+extern struct backstore backstore;
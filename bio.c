@@ -10,6 +10,10 @@
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
+// * breadn and bwriten do the same for a run of consecutive
+//     blocks, moving the run with one disk request.
+// * bwriteasync and bsubmit start a request without waiting
+//     for it; bwait waits for a batch of them.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
@@ -17,6 +21,10 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Requests go to the disk's driver through bdevsw, so
+// the rest of the kernel need not know which kind of disk
+// a device number names.
 
 #include "types.h"
 #include "defs.h"
@@ -35,6 +43,117 @@ struct {
   struct buf head;
 } bcache;
 
+// Block device switch: each driver serves a range of disk numbers.
+static struct bdevsw {
+  uint first;
+  uint ndev;
+  int (*read)(uint, uint, uchar*);  // polled read of one block, at boot
+  void (*rw)(struct buf*);          // sync a buf and its mnext bufs
+  void (*submit)(struct buf*);      // ... without waiting
+} bdevsw[] = {
+  { 0,    NIDE,    ideread,     iderw,     idesubmit },
+  { NIDE, NVIRTIO, virtio_read, virtio_rw, virtio_submit },
+};
+
+static struct bdevsw*
+bdev(uint dev)
+{
+  struct bdevsw *d;
+
+  for(d = bdevsw; d < &bdevsw[NELEM(bdevsw)]; d++)
+    if(dev >= d->first && dev < d->first + d->ndev)
+      return d;
+  return 0;
+}
+
+// Read block blockno of disk dev into dst without sleeping.
+// Returns -1 if there is no such disk or the read fails.
+int
+diskread(uint dev, uint blockno, uchar *dst)
+{
+  struct bdevsw *d;
+
+  if((d = bdev(dev)) == 0)
+    return -1;
+  return d->read(dev, blockno, dst);
+}
+
+// Sync b, and the bufs on b->mnext, with disk b->dev.
+void
+diskrw(struct buf *b)
+{
+  struct bdevsw *d;
+
+  if((d = bdev(b->dev)) == 0)
+    panic("diskrw: no such disk");
+  b->batch = 0;
+  d->rw(b);
+}
+
+// Asynchronous I/O.  bsubmit() starts a request and returns at
+// once, so a caller can have many requests outstanding and the
+// disk can order them; bwait() waits for all the requests
+// submitted through a batch.  A buf may also name a function for
+// the driver to call when its request completes.
+
+void
+binitbatch(struct biobatch *bb)
+{
+  initlock(&bb->lock, "biobatch");
+  bb->pending = 0;
+}
+
+// Start syncing locked buf b, and the bufs on b->mnext, with disk
+// as part of batch bb: write if B_DIRTY is set, else read.  May
+// sleep until the driver has room for the request.  The bufs must
+// stay locked until the request completes.
+void
+bsubmit(struct biobatch *bb, struct buf *b)
+{
+  struct bdevsw *d;
+
+  if((d = bdev(b->dev)) == 0)
+    panic("bsubmit: no such disk");
+  acquire(&bb->lock);
+  bb->pending++;
+  release(&bb->lock);
+  b->batch = bb;
+  d->submit(b);
+}
+
+// Wait until all the requests submitted through bb are done.
+void
+bwait(struct biobatch *bb)
+{
+  acquire(&bb->lock);
+  while(bb->pending > 0)
+    sleep(bb, &bb->lock);
+  release(&bb->lock);
+}
+
+// Called by a disk driver, holding its lock, once the request
+// headed by b is done and its bufs are marked.  b->done runs here,
+// in the interrupt handler, so it must not sleep.  Once it has,
+// b may belong to someone else.
+void
+biodone(struct buf *b)
+{
+  struct biobatch *bb;
+
+  bb = b->batch;
+  b->batch = 0;
+  if(b->done)
+    b->done(b);
+  if(bb == 0){
+    wakeup(b);
+    return;
+  }
+  acquire(&bb->lock);
+  if(--bb->pending == 0)
+    wakeup(bb);
+  release(&bb->lock);
+}
+
 void
 binit(void)
 {
@@ -92,6 +211,25 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Return how many buffers bget() could recycle now.  A caller
+// about to take several at once uses it to leave enough for
+// everyone else; it is only a hint, since others may take
+// buffers meanwhile.
+int
+bavail(void)
+{
+  struct buf *b;
+  int n;
+
+  n = 0;
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next)
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+      n++;
+  release(&bcache.lock);
+  return n;
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -100,11 +238,40 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    b->mnext = 0;
+    diskrw(b);
   }
   return b;
 }
 
+// Return n locked bufs in bp[] with the contents of blocks
+// blockno..blockno+n-1.  Each run of uncached blocks is read
+// with a single disk request, and the requests for all the
+// runs are outstanding together.
+void
+breadn(uint dev, uint blockno, struct buf **bp, int n)
+{
+  struct biobatch bb;
+  int i, j;
+
+  if(n > MAXRUNBLKS)
+    panic("breadn");
+  for(i = 0; i < n; i++)
+    bp[i] = bget(dev, blockno + i);
+  binitbatch(&bb);
+  for(i = 0; i < n; i = j){
+    if(bp[i]->flags & B_VALID){
+      j = i + 1;
+      continue;
+    }
+    for(j = i + 1; j < n && (bp[j]->flags & B_VALID) == 0; j++)
+      bp[j-1]->mnext = bp[j];
+    bp[j-1]->mnext = 0;
+    bsubmit(&bb, bp[i]);
+  }
+  bwait(&bb);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,7 +279,38 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  b->mnext = 0;
+  diskrw(b);
+}
+
+// Start writing b's contents to disk as part of batch bb.
+// Must be locked, and stay locked until bwait(bb) returns.
+void
+bwriteasync(struct biobatch *bb, struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwriteasync");
+  b->flags |= B_DIRTY;
+  b->mnext = 0;
+  bsubmit(bb, b);
+}
+
+// Write n locked bufs holding consecutive blocks
+// to disk with a single disk request.
+void
+bwriten(struct buf **bp, int n)
+{
+  int i;
+
+  if(n > MAXRUNBLKS)
+    panic("bwriten");
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bp[i]->lock))
+      panic("bwriten");
+    bp[i]->flags |= B_DIRTY;
+    bp[i]->mnext = (i + 1 < n) ? bp[i+1] : 0;
+  }
+  diskrw(bp[0]);
 }
 
 // Release a locked buffer.
@@ -7,8 +7,20 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
+  uint deadline;     // ticks by which the disk should have started it
+  struct buf *mnext; // next block of a multi-block request
+  uchar *page;       // if set, move the PGSIZE bytes here instead of data
+  struct biobatch *batch;    // batch of an asynchronous request
+  void (*done)(struct buf*); // if set, called when the request completes
   uchar data[BSIZE];
 };
+
+// Asynchronous requests started together; see bsubmit().
+struct biobatch {
+  struct spinlock lock;
+  int pending;       // requests not yet complete
+};
+
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
 
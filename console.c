@@ -260,7 +260,10 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
+    // dst is user memory, which may have to be paged in.
+    release(&cons.lock);
     *dst++ = c;
+    acquire(&cons.lock);
     --n;
     if(c == '\n')
       break;
@@ -274,13 +277,20 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-  int i;
+  char kbuf[128];
+  int i, m, done;
 
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  // Copy out of user memory, which may have to be paged in,
+  // before taking cons.lock.
+  for(done = 0; done < n; done += m){
+    m = n - done < sizeof(kbuf) ? n - done : sizeof(kbuf);
+    memmove(kbuf, buf + done, m);
+    acquire(&cons.lock);
+    for(i = 0; i < m; i++)
+      consputc(kbuf[i] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
@@ -1,3 +1,4 @@
+struct biobatch;
 struct buf;
 struct context;
 struct file;
@@ -9,14 +10,36 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
-struct backstore_frame;
+struct vmstat;
+struct vmproc;
+
+// backstore.c
+char*           backstore_init(char*);
+uint            backstore_alloc(void);
+void            backstore_free(uint);
+void            backstore_share(uint);
+uint            backstore_refcount(uint);
+void            backstore_read(uint, char*);
+void            backstore_read_async(uint, char*, struct biobatch*);
+void            backstore_write(uint, char*);
+void            backstore_stat(struct vmstat*);
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadn(uint, uint, struct buf**, int);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwriten(struct buf**, int);
 struct buf*     bget(uint, uint);
+int             bavail(void);
+int             diskread(uint, uint, uchar*);
+void            diskrw(struct buf*);
+void            binitbatch(struct biobatch*);
+void            bsubmit(struct biobatch*, struct buf*);
+void            bwait(struct biobatch*);
+void            bwriteasync(struct biobatch*, struct buf*);
+void            biodone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -43,6 +66,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            itext(struct inode*, int);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -58,8 +82,11 @@ int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
-void            ideintr(void);
+int             ideread(uint, uint, uchar*);
+void            ideintr(int);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            ide_stat(struct vmstat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -69,6 +96,9 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+uint            kfreecount(void);
+void            kshare(char*);
+int             krefcount(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -98,6 +128,29 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+int             pcache_put(struct inode*, uint, char*);
+int             pcache_shrink(void);
+void            pcache_invalidate(struct inode*);
+void            pcache_stat(struct vmstat*);
+
+// zswap.c
+char*           zswapinit(char*, uint);
+int             zswap_store(uint, char*);
+int             zswap_load(uint, char*);
+void            zswap_drop(uint);
+int             zswap_budget(int);
+void            zswap_stat(struct vmstat*);
+
+// pci.c
+void            pciinit(void);
+int             pcifind(uint, uint);
+int             pcilookup(uint, uint, int);
+uint            pciread(int, uint);
+void            pciwrite(int, uint, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -111,8 +164,15 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+struct proc*    kthread(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+int             pageout_begin(struct proc*);
+void            pageout_end(struct proc*);
+void            pageout_each(void (*)(struct proc*));
+int             pageout_mappers(struct proc*, uint, uint, struct proc**, int);
+void            pageout_endn(struct proc**, int);
+int             proc_vmstat(int, struct vmproc*);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -120,6 +180,7 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            vmbusy(int);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
@@ -179,6 +240,10 @@ void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
+int             allocanon(pde_t*, uint, uint);
+void            mapframe(struct proc*, uint, char*);
+int             mapsframe(pde_t*, uint, uint);
+char*           getframe(struct proc*);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
@@ -189,13 +254,25 @@ void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearptep(pde_t *pgdir, char *uva);
 void            clearpteu(pde_t *pgdir, char *uva);
-void            replace_page(struct proc*);
+int             replace_page(struct proc*);
+int             replace_global(void);
 void            page_fault_handler(uint addr);
-int             load_frame(char* pa, char* va);
-int             store_page(struct proc*, uint);
-uint            get_free_block(void);
-void            backstore_init(void);
-void            free_backstore();
+int             load_frame(pde_t*, uint, char*);
+int             store_page(pde_t*, uint, char*);
+void            vm_stat(struct vmstat*);
+int             vm_ctl(int, int);
+void            kswapdinit(void);
+char*           frameinit(char*);
+void            kswapd_wakeup(uint);
+void            vm_tick(void);
+
+// virtio.c
+void            virtioinit(void);
+int             virtio_intr(int);
+int             virtio_read(uint, uint, uchar*);
+void            virtio_rw(struct buf*);
+void            virtio_submit(struct buf*);
+void            virtio_stat(struct vmstat*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -17,11 +17,13 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  struct inode *exe, *oldexe;
+  struct segment seg[MAXSEG];
+  int nseg;
+  char *stack;
   struct proc *curproc = myproc();
   curproc->page_inserted = 0;
   curproc->page_fault_count = 0;
-  free_backstore(curproc);
-  curproc->blist = 0;
 
   begin_op();
 
@@ -30,9 +32,10 @@ exec(char *path, char **argv)
     cprintf("exec: fail\n");
     return -1;
   }
-  safestrcpy((curproc->path), path, strlen(path) + 1);
   ilock(ip);
   pgdir = 0;
+  stack = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -43,8 +46,9 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the loadable segments; page faults read them in.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -58,9 +62,18 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(nseg == MAXSEG)
+      goto bad;
+    seg[nseg].vaddr = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].memsz = ph.memsz;
+    nseg++;
   }
-  iunlockput(ip);
+  itext(ip, 1);
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
   curproc->elf_size = sz; // size of code+data+bss 
 
@@ -70,7 +83,11 @@ exec(char *path, char **argv)
   if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-  char* buffer = curproc->buf;
+
+  // Build the stack page in a frame of its own; it is mapped
+  // resident once the new page table is in use.
+  stack = getframe(curproc);
+  memset(stack, 0, PGSIZE);
   sp = PGSIZE;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -78,7 +95,7 @@ exec(char *path, char **argv)
     if(argc >= MAXARG)
       goto bad;
     sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    safestrcpy(&(curproc->buf[sp]), argv[argc], strlen(argv[argc]) + 1);
+    safestrcpy(stack + sp, argv[argc], strlen(argv[argc]) + 1);
     ustack[3+argc] = PGROUNDUP(curproc->elf_size) + PGSIZE + sp;
   }
   ustack[3+argc] = 0;
@@ -88,9 +105,7 @@ exec(char *path, char **argv)
   ustack[2] = PGROUNDUP(curproc->elf_size) + PGSIZE + (sp - (argc+1)*4);  // argv pointer
 
   sp -= (3+argc+1) * 4;
-  memmove(buffer+sp, ustack, (3+argc+1)*4);
-  if(store_page(curproc, sz - PGSIZE) < 0)
-      panic("no space to store stack in backstore");
+  memmove(stack+sp, ustack, (3+argc+1)*4);
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
@@ -98,23 +113,48 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
-  // Commit to the user image.
+  // Commit to the user image.  Until the old page table is gone
+  // the resident ring names frames in it, so keep kswapd away.
+  vmbusy(1);
+  oldexe = curproc->exe;
+  curproc->exe = exe;
+  for(i = 0; i < nseg; i++)
+    curproc->seg[i] = seg[i];
+  curproc->nseg = nseg;
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = PGROUNDUP(curproc->elf_size) + PGSIZE + sp;
   curproc->alloc = 0;
+  curproc->ra_next = 0;
+  curproc->ra_window = 0;
+  mapframe(curproc, sz - PGSIZE, stack);
   switchuvm(curproc);
   freevm(oldpgdir);
+  vmbusy(0);
+  if(oldexe){
+    itext(oldexe, -1);
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
   return 0;
 
  bad:
+  if(stack)
+    kfree(stack);
   if(pgdir)
     freevm(pgdir);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    itext(exe, -1);
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
@@ -14,6 +14,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int text;           // Processes executing it; protected by icache.lock
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
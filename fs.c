@@ -180,9 +180,9 @@ iinit(int dev)
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
-          sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+ inodestart %d bmap start %d swap start %d nswap %d\n", sb.size,
+          sb.nblocks, sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
+          sb.bmapstart, sb.swapstart, sb.nswap);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -282,6 +282,18 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count ip as the executable of one more process, or one fewer.
+// Unwritten text pages are dropped and read from the executable
+// again at the next fault, so writei() refuses to change a file
+// that any process is executing.
+void
+itext(struct inode *ip, int n)
+{
+  acquire(&icache.lock);
+  ip->text += n;
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -432,6 +444,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcache_invalidate(ip);
 }
 
 // Copy stat information from inode.
@@ -446,13 +459,39 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Bring blocks bn..end-1 of ip, or as many of them as lie
+// consecutively on disk, into the cache with one disk request.
+// The run is cut short when the cache is low on free buffers,
+// so that concurrent readers and the log always find one.
+// Returns the number of blocks covered.
+static uint
+readrun(struct inode *ip, uint bn, uint end)
+{
+  struct buf *bp[MAXRUNBLKS];
+  uint addr, n, i, max;
+  int avail;
+
+  avail = bavail() - MAXRUNBLKS;
+  max = avail < 1 ? 1 : avail < MAXRUNBLKS ? avail : MAXRUNBLKS;
+  addr = bmap(ip, bn);
+  for(n = 1; n < max && bn + n < end; n++)
+    if(bmap(ip, bn + n) != addr + n)
+      break;
+  if(n > 1){
+    breadn(ip->dev, addr, bp, n);
+    for(i = 0; i < n; i++)
+      brelse(bp[i]);
+  }
+  return n;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, run;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -466,7 +505,11 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  run = 0;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if(run == 0)
+      run = readrun(ip, off/BSIZE, (off + n - tot + BSIZE - 1)/BSIZE);
+    run--;
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
@@ -482,6 +525,7 @@ int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
+  int text;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -494,6 +538,13 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  acquire(&icache.lock);
+  text = ip->text;
+  release(&icache.lock);
+  if(text)
+    return -1;  // being executed, see itext()
+  if(n > 0)
+    pcache_invalidate(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
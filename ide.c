@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses bus-master DMA when there is a
+// PIIX-style PCI IDE controller, and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "vmstat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,146 +26,538 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_READ_DMA  0xc8
+#define IDE_CMD_WRITE_DMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Bus-master IDE registers, as offsets from a channel's
+// bus-master base.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // transfer from the disk to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
 
-static struct spinlock idelock;
-static struct buf *idequeue;
+// A physical region descriptor names one piece of a DMA transfer.
+// A piece may not cross a 64KB boundary.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor of the table
 
-static int havedisk1;
-static void idestart(struct buf*);
+// Sectors per READ/WRITE MULTIPLE data block.  A PIO command
+// never exceeds one block, so it takes one interrupt.
+#define IDE_MULTSECT  (MAXRUNBLKS*BSIZE/SECTOR_SIZE)
+// Most sectors in one DMA command, and the descriptors that
+// can take: a sector's data crosses at most one 64KB boundary.
+#define IDE_DMASECT   64
+#define NPRD          (2*IDE_DMASECT)
+
+// Each IDE channel is a controller with its own ports, interrupt
+// and queue, and drives a master and a slave disk: disk dev is
+// drive dev&1 of channel dev/2.  Channels work independently, so
+// requests to disks on different channels run at the same time.
+//
+// c->queue holds the requests waiting for the channel, oldest
+// first, linked through qnext; c->tail points at the last qnext.
+// c->cur is the command in progress: one request, or several for
+// consecutive blocks linked through qnext.  A request can itself
+// cover several consecutive blocks: the bufs after the first hang
+// off its mnext and are never queued.  A buf with page set instead
+// moves a whole page to or from that frame.
+//
+// The next command starts with the request that comes next in
+// C-LOOK order, sweeping up from c->pos and then wrapping to the
+// lowest block.  The exception is the oldest request, if it has
+// waited past its deadline.  Queued requests for the blocks just
+// after it are merged into the same command.
+// You must hold c->lock while manipulating the channel.
+
+#define NCHAN (NIDE/2)
+
+struct channel {
+  struct prd prdt[NPRD];  // first, for its alignment
+  struct spinlock lock;
+  ushort base;            // command block registers
+  ushort ctl;             // device control register
+  ushort bm;              // bus-master registers, 0 to use PIO
+  int irq;
+  int havedisk[2];
+  struct buf *queue;
+  struct buf **tail;
+  struct buf *cur;
+  uint pos;
+
+  uint requests;  // iderw() calls
+  uint commands;  // disk commands issued
+  uint merged;    // requests merged into another's command
+  uint expired;   // commands started for a request past its deadline
+  uint depth;     // requests now queued
+  uint maxdepth;
+} __attribute__((aligned(sizeof(struct prd)*NPRD)));
+
+static struct channel chan[NCHAN] = {
+  { .base = 0x1f0, .ctl = 0x3f6, .irq = IRQ_IDE },
+  { .base = 0x170, .ctl = 0x376, .irq = IRQ_IDE2 },
+};
+
+// dev and block as one number, for C-LOOK order.
+#define IDEKEY(dev, blockno)  ((dev) << 28 | (blockno))
+
+static void idestart(struct channel*);
 
 // Wait for IDE disk to become ready.
 static int
-idewait(int checkerr)
+idewait(struct channel *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(c->base+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Check if disk is present on channel c.
+static int
+idepresent(struct channel *c, int disk)
+{
+  int i, r;
+
+  outb(c->base+6, 0xe0 | (disk<<4));
+  for(i=0; i<1000; i++){
+    r = inb(c->base+7);
+    if(r != 0 && r != 0xff)  // 0xff: nothing on the channel
+      return 1;
+  }
+  return 0;
+}
+
+// Make READ/WRITE MULTIPLE move IDE_MULTSECT sectors per interrupt.
+static void
+idesetmult(struct channel *c, int disk)
+{
+  idewait(c, 0);
+  outb(c->base+2, IDE_MULTSECT);
+  outb(c->base+6, 0xe0 | (disk<<4));
+  outb(c->base+7, IDE_CMD_SETMUL);
+  idewait(c, 0);
+}
+
+// Find the PCI IDE controller and let it master the bus, so that
+// idestart() can use DMA.  Without one, the driver uses PIO.
+// The secondary channel's bus-master registers follow the
+// primary's.
+static void
+idedmainit(void)
+{
+  int tag, i;
+  uint bar;
+
+  if((tag = pcifind(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE)) < 0)
+    return;
+  bar = pciread(tag, PCI_BAR(4));
+  if(!(bar & 1) || (bar & ~3) == 0)  // not an I/O space BAR
+    return;
+  pciwrite(tag, PCI_COMMAND, pciread(tag, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+  for(i = 0; i < NCHAN; i++)
+    chan[i].bm = (bar & ~3) + 8*i;
+}
+
+// Add the n bytes at va to c's PRD table at p.  Returns the
+// next free descriptor.
+static struct prd*
+prdadd(struct channel *c, struct prd *p, uchar *va, uint n)
+{
+  uint pa, len;
+
+  for(pa = V2P(va); n > 0; pa += len, n -= len){
+    len = 0x10000 - (pa & 0xffff);
+    if(len > n)
+      len = n;
+    if(p >= &c->prdt[NPRD])
+      panic("prdadd");
+    p->addr = pa;
+    p->len = len;
+    p->flags = 0;
+    p++;
+  }
+  return p;
+}
+
+// Point c's controller at the data of command b and start the
+// transfer.  The disk registers must already be set up for b.
+static void
+idedmastart(struct channel *c, struct buf *b)
+{
+  struct buf *r, *m;
+  struct prd *p;
+
+  p = c->prdt;
+  for(r = b; r; r = r->qnext){
+    if(r->page)
+      p = prdadd(c, p, r->page, PGSIZE);
+    else
+      for(m = r; m; m = m->mnext)
+        p = prdadd(c, p, m->data, BSIZE);
+  }
+  p[-1].flags = PRD_EOT;
+
+  outl(c->bm + BM_PRDT, V2P(c->prdt));
+  outb(c->bm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+  outb(c->bm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);  // write 1 to clear
+  outb(c->base+7, (b->flags & B_DIRTY) ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+  outb(c->bm + BM_CMD, inb(c->bm + BM_CMD) | BM_CMD_START);
+}
+
+// Stop c's controller after its interrupt.
+// Returns -1 if the transfer failed.
+static int
+idedmadone(struct channel *c)
+{
+  int st;
+
+  outb(c->bm + BM_CMD, 0);
+  st = inb(c->bm + BM_STATUS);
+  outb(c->bm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+  if((st & BM_ST_ERR) || idewait(c, 1) < 0)
+    return -1;
+  return 0;
+}
+
 void
 ideinit(void)
 {
-  int i;
+  struct channel *c;
+  int disk;
 
-  initlock(&idelock, "ide");
-  ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
+  for(c = chan; c < &chan[NCHAN]; c++){
+    initlock(&c->lock, "ide");
+    c->tail = &c->queue;
+    for(disk = 0; disk < 2; disk++)
+      c->havedisk[disk] = idepresent(c, disk);
+    if(c == chan)
+      c->havedisk[0] = 1;  // we booted from it
+    if(!c->havedisk[0] && !c->havedisk[1])
+      continue;
 
-  // Check if disk 1 is present
-  outb(0x1f6, 0xe0 | (1<<4));
-  for(i=0; i<1000; i++){
-    if(inb(0x1f7) != 0){
-      havedisk1 = 1;
-      break;
+    // Give each channel's interrupt its own CPU where there are enough.
+    ioapicenable(c->irq, (ncpu - 1) - (c - chan) % ncpu);
+    outb(c->ctl, 2);  // no interrupts while setting up
+    for(disk = 0; disk < 2; disk++)
+      if(c->havedisk[disk])
+        idesetmult(c, disk);
+
+    // Switch back to disk 0.
+    outb(c->base+6, 0xe0 | (0<<4));
+  }
+
+  idedmainit();
+}
+
+// Move the data of command b by PIO.
+static void
+idepio(struct channel *c, struct buf *b, int write)
+{
+  struct buf *r, *m;
+
+  for(r = b; r; r = r->qnext){
+    if(r->page){
+      if(write)
+        outsl(c->base, r->page, PGSIZE/4);
+      else
+        insl(c->base, r->page, PGSIZE/4);
+      continue;
+    }
+    for(m = r; m; m = m->mnext){
+      if(write)
+        outsl(c->base, m->data, BSIZE/4);
+      else
+        insl(c->base, m->data, BSIZE/4);
     }
   }
+}
 
-  // Switch back to disk 0.
-  outb(0x1f6, 0xe0 | (0<<4));
+// Number of blocks request b moves.
+static int
+reqblocks(struct buf *b)
+{
+  int n;
+
+  if(b->page)
+    return PGSIZE/BSIZE;
+  for(n = 0; b; b = b->mnext)
+    n++;
+  return n;
+}
+
+// Whether a comes before d in C-LOOK order on c.
+static int
+before(struct channel *c, uint a, uint d)
+{
+  if((a >= c->pos) != (d >= c->pos))
+    return a >= c->pos;
+  return a < d;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Take *pp off c's queue and return it.
+static struct buf*
+dequeue(struct channel *c, struct buf **pp)
+{
+  struct buf *b;
+
+  b = *pp;
+  *pp = b->qnext;
+  if(c->tail == &b->qnext)
+    c->tail = pp;
+  b->qnext = 0;
+  c->depth--;
+  return b;
+}
+
+// If channel c is idle, start its next command.
+// Caller must hold c->lock.
 static void
-idestart(struct buf *b)
+idestart(struct channel *c)
 {
-  if(b == 0)
-    panic("idestart");
-  if(b->blockno >= FSSIZE && b->blockno <= ROOTDEV)
-    panic("incorrect blockno");
+  struct buf *b, *r, *tail, **pp, **bp;
+  int nblock, maxblock;
+
+  if(c->cur || c->queue == 0)
+    return;
+
+  bp = &c->queue;
+  if((int)(ticks - c->queue->deadline) < 0){
+    for(pp = &c->queue->qnext; *pp; pp = &(*pp)->qnext)
+      if(before(c, IDEKEY((*pp)->dev, (*pp)->blockno), IDEKEY((*bp)->dev, (*bp)->blockno)))
+        bp = pp;
+  } else
+    c->expired++;
+  b = dequeue(c, bp);
+
+  // Merge the requests for the blocks that follow.
+  maxblock = (c->bm ? IDE_DMASECT : IDE_MULTSECT) * SECTOR_SIZE / BSIZE;
+  nblock = reqblocks(b);
+  tail = b;
+  for(pp = &c->queue; *pp; ){
+    r = *pp;
+    if(r->dev != b->dev || r->blockno != b->blockno + nblock ||
+       (r->flags & B_DIRTY) != (b->flags & B_DIRTY) ||
+       nblock + reqblocks(r) > maxblock){
+      pp = &r->qnext;
+      continue;
+    }
+    tail->qnext = dequeue(c, pp);
+    tail = r;
+    nblock += reqblocks(r);
+    c->merged++;
+    pp = &c->queue;  // an earlier request may follow on now
+  }
+  c->cur = b;
+  c->pos = IDEKEY(b->dev, b->blockno + nblock);
+  c->commands++;
+
   int sector_per_block =  BSIZE/SECTOR_SIZE;
+  int nsector = nblock * sector_per_block;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
-
-  if (sector_per_block > 7) panic("idestart");
-
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  int read_cmd = (nsector == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+  if (nsector > (c->bm ? IDE_DMASECT : IDE_MULTSECT)) panic("idestart");
+
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->base+2, nsector);  // number of sectors
+  outb(c->base+3, sector & 0xff);
+  outb(c->base+4, (sector >> 8) & 0xff);
+  outb(c->base+5, (sector >> 16) & 0xff);
+  outb(c->base+6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(c->bm){
+    idedmastart(c, b);
+  } else if(b->flags & B_DIRTY){
+    outb(c->base+7, write_cmd);
+    idepio(c, b, 1);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(c->base+7, read_cmd);
   }
 }
 
-// Interrupt handler.
+// The channel of disk dev, or 0 if there is no such disk.
+static struct channel*
+idechan(uint dev)
+{
+  if(dev >= 2*NCHAN || !chan[dev/2].havedisk[dev&1])
+    return 0;
+  return &chan[dev/2];
+}
+
+// Read block blockno of disk dev into dst, polling for the
+// result.  Only for use at boot, before there is a process to
+// sleep in iderw() or any other request queued.
+// Returns -1 if there is no such disk or the read fails.
+int
+ideread(uint dev, uint blockno, uchar *dst)
+{
+  struct channel *c;
+
+  if((c = idechan(dev)) == 0)
+    return -1;
+
+  acquire(&c->lock);
+  idewait(c, 0);
+  outb(c->ctl, 2);  // no interrupt
+  outb(c->base+2, 1);
+  outb(c->base+3, blockno & 0xff);
+  outb(c->base+4, (blockno >> 8) & 0xff);
+  outb(c->base+5, (blockno >> 16) & 0xff);
+  outb(c->base+6, 0xe0 | ((dev&1)<<4) | ((blockno>>24)&0x0f));
+  outb(c->base+7, IDE_CMD_READ);
+  if(idewait(c, 1) < 0){
+    release(&c->lock);
+    return -1;
+  }
+  insl(c->base, dst, SECTOR_SIZE/4);
+  release(&c->lock);
+  return 0;
+}
+
+// Interrupt handler for channel n.
 void
-ideintr(void)
+ideintr(int n)
 {
-  struct buf *b;
+  struct channel *c;
+  struct buf *b, *r, *m, *next;
 
-  // First queued buffer is the active request.
-  acquire(&idelock);
+  c = &chan[n];
+  acquire(&c->lock);
 
-  if((b = idequeue) == 0){
-    release(&idelock);
+  if((b = c->cur) == 0){
+    release(&c->lock);
+    return;
+  }
+  c->cur = 0;
+
+  // If DMA failed, queue the command's requests again at the
+  // front, and redo them and all later ones with PIO.
+  if(c->bm && idedmadone(c) < 0){
+    cprintf("ide%d: dma failed, using pio\n", n);
+    c->bm = 0;
+    for(r = b; ; r = r->qnext){
+      c->depth++;
+      if(r->qnext == 0)
+        break;
+    }
+    if((r->qnext = c->queue) == 0)
+      c->tail = &r->qnext;
+    c->queue = b;
+    idestart(c);
+    release(&c->lock);
     return;
   }
-  idequeue = b->qnext;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(!c->bm && !(b->flags & B_DIRTY) && idewait(c, 1) >= 0)
+    idepio(c, b, 0);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Complete the command's requests.
+  for(r = b; r; r = next){
+    next = r->qnext;
+    r->qnext = 0;
+    for(m = r; m; m = m->mnext){
+      m->flags |= B_VALID;
+      m->flags &= ~B_DIRTY;
+    }
+    biodone(r);
+  }
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on the next command.
+  idestart(c);
 
-  release(&idelock);
+  release(&c->lock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue a request to sync buf with disk, and return without
+// waiting for it; the interrupt handler calls biodone() when it
+// is done.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// The bufs on b->mnext, which must hold the blocks that follow
+// b's, are synced along with b in the same disk request.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
-  struct buf **pp;
+  struct channel *c;
+  struct buf *m;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  for(m = b; m; m = m->mnext){
+    if(!holdingsleep(&m->lock))
+      panic("idesubmit: buf not locked");
+    if((m->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("idesubmit: nothing to do");
+    if(m != b && (m->dev != b->dev || (m->flags & B_DIRTY) != (b->flags & B_DIRTY)))
+      panic("idesubmit: mixed request");
+    if(m->mnext && m->mnext->blockno != m->blockno + 1)
+      panic("idesubmit: blocks not consecutive");
+  }
+  if(b->page && b->mnext)
+    panic("idesubmit: page request with mnext");
+  if((c = idechan(b->dev)) == 0)
+    panic("idesubmit: no such disk");
 
-  acquire(&idelock);  //DOC:acquire-lock
+  acquire(&c->lock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
+  // Append b to the channel's queue.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  b->deadline = ticks + IDEDEADLINE;
+  *c->tail = b;  //DOC:insert-queue
+  c->tail = &b->qnext;
+  c->requests++;
+  if(++c->depth > c->maxdepth)
+    c->maxdepth = c->depth;
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  idestart(c);
+
+  release(&c->lock);
+}
 
-  // Wait for request to finish.
+// Sync buf with disk, as idesubmit() does, and wait for it.
+void
+iderw(struct buf *b)
+{
+  struct channel *c;
+
+  idesubmit(b);
+
+  c = idechan(b->dev);
+  acquire(&c->lock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+    sleep(b, &c->lock);
   }
+  release(&c->lock);
+}
 
+void
+ide_stat(struct vmstat *st)
+{
+  struct channel *c;
 
-  release(&idelock);
+  st->io_requests = st->io_commands = st->io_merged = 0;
+  st->io_expired = st->io_depth = st->io_maxdepth = 0;
+  for(c = chan; c < &chan[NCHAN]; c++){
+    acquire(&c->lock);
+    st->io_requests += c->requests;
+    st->io_commands += c->commands;
+    st->io_merged += c->merged;
+    st->io_expired += c->expired;
+    st->io_depth += c->depth;
+    st->io_maxdepth += c->maxdepth;
+    release(&c->lock);
+  }
 }
@@ -21,6 +21,8 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uint nfree;  // number of pages on freelist
+  uchar ref[PHYSTOP/PGSIZE];  // page tables mapping each page
 } kmem;
 
 // Initialization happens in two phases.
@@ -56,6 +58,8 @@ freerange(void *vstart, void *vend)
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page shared with kshare() is only freed when
+// the last reference to it is dropped.
 void
 kfree(char *v)
 {
@@ -64,6 +68,18 @@ kfree(char *v)
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) / PGSIZE] > 1){
+    kmem.ref[V2P(v) / PGSIZE]--;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  kmem.ref[V2P(v) / PGSIZE] = 0;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -72,6 +88,7 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
@@ -79,18 +96,52 @@ kfree(char *v)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// Wakes the page-out daemon if free pages are running low.
 char*
 kalloc(void)
 {
   struct run *r;
+  uint nfree;
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
-  if(kmem.use_lock)
+    kmem.nfree--;
+    kmem.ref[V2P(r) / PGSIZE] = 1;
+  }
+  nfree = kmem.nfree;
+  if(kmem.use_lock){
     release(&kmem.lock);
+    kswapd_wakeup(nfree);
+  }
   return (char*)r;
 }
 
+// Number of free pages.
+uint
+kfreecount(void)
+{
+  return kmem.nfree;
+}
+
+
+// Take another reference to the allocated page v, so that
+// it survives one more kfree().
+void
+kshare(char *v)
+{
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) / PGSIZE] == 0 || kmem.ref[V2P(v) / PGSIZE] == 255)
+    panic("kshare");
+  kmem.ref[V2P(v) / PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Number of references to the allocated page v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v) / PGSIZE];
+}
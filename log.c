@@ -65,19 +65,31 @@ initlog(int dev)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// The writes go out MAXRUNBLKS at a time without waiting for
+// each other, so the disk can order them.
 static void
 install_trans(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  struct biobatch bb;
+  struct buf *dbuf[MAXRUNBLKS];
+  int tail, n, i;
+
+  binitbatch(&bb);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > MAXRUNBLKS)
+      n = MAXRUNBLKS;
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+      bwriteasync(&bb, dbuf[i]);  // write dst to disk
+    }
+    bwait(&bb);
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
   }
 }
 
@@ -174,18 +186,30 @@ end_op(void)
 }
 
 // Copy modified blocks from cache to log.
+// The log blocks are consecutive, so they go out
+// MAXRUNBLKS at a time, or fewer if the cache is short
+// of free buffers; one is always enough.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[MAXRUNBLKS];
+  int tail, n, i, avail;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > MAXRUNBLKS)
+      n = MAXRUNBLKS;
+    if ((avail = bavail()) < n)
+      n = avail > 1 ? avail : 1;
+    for (i = 0; i < n; i++) {
+      to[i] = bget(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwriten(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
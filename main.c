@@ -5,6 +5,8 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "spinlock.h"
+#include "backstore.h"
 
 static void startothers(void);
 static void mpmain(void)  __attribute__((noreturn));
@@ -17,6 +19,8 @@ extern char end[]; // first address after kernel loaded from ELF file
 int
 main(void)
 {
+  char *vstart;
+
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
@@ -29,12 +33,18 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcacheinit();    // executable page cache
   fileinit();      // file table
+  pciinit();       // PCI functions
   ideinit();       // disk 
+  virtioinit();    // virtio disks
   startothers();   // start other processors
-  backstore_init();
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  vstart = frameinit(P2V(4*1024*1024)); // physical frame table
+  vstart = backstore_init(vstart);      // swap slot table
+  vstart = zswapinit(vstart, backstore.nslots); // compressed swap pool
+  kinit2(vstart, P2V(PHYSTOP)); // must come after startothers()
   userinit();      // first user process
+  kswapdinit();    // page-out daemon
   mpmain();        // finish this processor's setup
 }
 
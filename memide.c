@@ -12,22 +12,37 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "vmstat.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_memfs_img_start[], _binary_memfs_img_size[];
 
 static int disksize;
 static uchar *memdisk;
+static uint nrequests;
 
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_memfs_img_start;
+  disksize = (uint)_binary_memfs_img_size/BSIZE;
+}
+
+// Read block blockno into dst, as at boot.
+// Returns -1 if there is no such disk.
+int
+ideread(uint dev, uint blockno, uchar *dst)
+{
+  if(dev != 1)
+    return -1;
+  if(blockno >= disksize)
+    panic("ideread: block out of range");
+  memmove(dst, memdisk + blockno*BSIZE, BSIZE);
+  return 0;
 }
 
 // Interrupt handler.
 void
-ideintr(void)
+ideintr(int n)
 {
   // no-op
 }
@@ -35,26 +50,53 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// The bufs on b->mnext are synced along with b.
+// The request is done by the time idesubmit() returns.
+void
+idesubmit(struct buf *b)
+{
+  struct buf *m;
+  uchar *p, *data;
+  int n;
+
+  nrequests++;
+  for(m = b; m; m = m->mnext){
+    if(!holdingsleep(&m->lock))
+      panic("idesubmit: buf not locked");
+    if((m->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("idesubmit: nothing to do");
+    if(m->dev != 1)
+      panic("idesubmit: request not for disk 1");
+    data = m->page ? m->page : m->data;
+    n = m->page ? PGSIZE : BSIZE;
+    if(m->blockno + n/BSIZE > disksize)
+      panic("idesubmit: block out of range");
+
+    p = memdisk + m->blockno*BSIZE;
+
+    if(m->flags & B_DIRTY){
+      m->flags &= ~B_DIRTY;
+      memmove(p, data, n);
+    } else
+      memmove(data, p, n);
+    m->flags |= B_VALID;
+  }
+  biodone(b);
+}
+
 void
 iderw(struct buf *b)
 {
-  uchar *p;
-
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 1)
-    panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
-    panic("iderw: block out of range");
-
-  p = memdisk + b->blockno*BSIZE;
-
-  if(b->flags & B_DIRTY){
-    b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
-  } else
-    memmove(b->data, p, BSIZE);
-  b->flags |= B_VALID;
+  idesubmit(b);
+}
+
+void
+ide_stat(struct vmstat *st)
+{
+  st->io_requests = nrequests;
+  st->io_commands = nrequests;
+  st->io_merged = 0;
+  st->io_expired = 0;
+  st->io_depth = 0;
+  st->io_maxdepth = 0;
 }
@@ -18,13 +18,14 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks | swap ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
+int nswap;    // Number of swap blocks
 
 int fsfd;
 struct superblock sb;
@@ -67,7 +68,7 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, cc, fd, pgblocks, swaponly;
   uint rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
@@ -76,11 +77,26 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  swaponly = 0;
+  if(argc >= 3 && (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-w") == 0)){
+    swaponly = argv[1][1] == 'w';
+    nswap = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2 || nswap < 0 || (swaponly && argc != 2)){
+    fprintf(stderr, "Usage: mkfs [-s swapblocks] fs.img files...\n"
+                    "       mkfs -w swapblocks swap.img\n");
     exit(1);
   }
 
+  // The kernel swaps whole pages, and names a slot with the 20
+  // bits a non-present PTE has above its flags.
+  pgblocks = 4096/BSIZE;
+  nswap -= nswap % pgblocks;
+  if(nswap / pgblocks > (1<<20))
+    nswap = (1<<20) * pgblocks;
+
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
@@ -92,7 +108,22 @@ main(int argc, char *argv[])
 
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta + BACKSTORE_SIZE;
+  nblocks = FSSIZE - nmeta;
+
+  if(swaponly){
+    // A disk for swap alone: just a super block naming the area.
+    sb.swapmagic = xint(SWAPMAGIC);
+    sb.swapstart = xint(2);
+    sb.nswap = xint(nswap);
+    printf("swap %d\n", nswap);
+    memset(buf, 0, sizeof(buf));
+    memmove(buf, &sb, sizeof(sb));
+    wsect(0, zeroes);
+    wsect(1, buf);
+    if(nswap > 0)
+      wsect(2 + nswap - 1, zeroes);
+    exit(0);
+  }
 
   sb.size = xint(FSSIZE);
   sb.nblocks = xint(nblocks);
@@ -101,14 +132,21 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  if(nswap > 0)
+    sb.swapmagic = xint(SWAPMAGIC);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(nswap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d swap %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, nswap);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
+  // Extend the image over the swap area; its contents don't matter.
+  if(nswap > 0)
+    wsect(FSSIZE + nswap - 1, zeroes);
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
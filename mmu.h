@@ -94,8 +94,20 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
 
+// The hardware ignores a PTE without PTE_P, so such a PTE
+// can name the backstore slot that holds its page instead.
+#define PTE_SWAP        0x100   // !PTE_P: PTE_SLOT holds a backstore slot
+#define PTE_SLOT(pte)   ((uint)(pte) >> PTXSHIFT)
+#define SLOTPTE(slot)   ((uint)(slot) << PTXSHIFT)
+#define PTE_ZERO        0x200   // !PTE_P: anonymous page of zeros, no slot
+// Bit 8 (Global) of a present PTE is ignored because
+// CR4.PGE is never set, so it is free for software too.
+#define PTE_RA          0x100   // PTE_P: swapped in ahead, not yet seen used
+
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0x1FF)
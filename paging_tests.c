@@ -7,12 +7,15 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "vmstat.h"
 
 //static char  buf[8192];
 //static char  name[3];
 //static char *echoargv[] = {"echo", "ALL", "TESTS", "PASSED", 0};
 static int   stdout     = 1;
 #define TOTAL_MEMORY (1 << 21) + (1 << 18) + (1 << 17)
+#define PGSIZE 4096
+#define NPAGES 64
 
 void test_1(void) {
     void *m1    = 0, *m2, *start;
@@ -52,3 +55,219 @@ failed:
     printf(stdout, "test 1 failed!\n");
     exit();
 }
+
+// Make the page-out daemon free about n frames, taking them from
+// sleeping processes as well as this one.  Waits up to 100 ticks
+// for it and returns how many pages were evicted meanwhile.
+int squeeze(int n) {
+    struct vmstat st, now;
+    int   lo, hi, i;
+    char *p;
+
+    vmstat(&st);
+    lo = vmctl(VMCTL_LOWATER, -1);
+    hi = vmctl(VMCTL_HIWATER, -1);
+    vmctl(VMCTL_HIWATER, st.free_pages + n);
+    vmctl(VMCTL_LOWATER, st.free_pages + n);
+    p = sbrk(PGSIZE);
+    p[0] = 1;  // a page fault wakes it
+    for (i = 0; i < 10; i++) {
+        sleep(10);
+        vmstat(&now);
+        if (now.free_pages >= st.free_pages + n) break;
+    }
+    vmctl(VMCTL_LOWATER, lo);
+    vmctl(VMCTL_HIWATER, hi);
+    sbrk(-PGSIZE);
+    return now.kswapd_pages + now.direct_pages - st.kswapd_pages - st.direct_pages;
+}
+
+void fill(char *a, int seed) {
+    int i;
+
+    for (i = 0; i < NPAGES * PGSIZE / sizeof(int); i++) ((int *)a)[i] = seed + i;
+}
+
+int check(char *a, int seed) {
+    int i;
+
+    for (i = 0; i < NPAGES * PGSIZE / sizeof(int); i++)
+        if (((int *)a)[i] != seed + i) return 0;
+    return 1;
+}
+
+// Copy-on-write: after fork() each side writes the shared pages
+// and must not see the other's writes, whether the parent or the
+// child writes first and whether the pages were swapped out
+// before the fork or while shared.
+void test_2(void) {
+    char *a, ok;
+    int   go[2], res[2];
+
+    printf(stdout, "test 2\n");
+
+    a = sbrk(NPAGES * PGSIZE);
+    fill(a, 1);
+    if (squeeze(2 * NPAGES) == 0) goto failed;
+    if (pipe(go) < 0 || pipe(res) < 0) goto failed;
+
+    // Parent writes first.
+    if (fork() == 0) {
+        read(go[0], &ok, 1);
+        ok = check(a, 1);
+        fill(a, 2);
+        ok = ok && check(a, 2);
+        write(res[1], &ok, 1);
+        exit();
+    }
+    ok = squeeze(2 * NPAGES) > 0;
+    fill(a, 3);
+    ok = squeeze(2 * NPAGES) > 0 && ok;
+    write(go[1], "x", 1);
+    if (!ok) goto failed;
+    if (read(res[0], &ok, 1) != 1 || !ok) goto failed;
+    wait();
+    if (!check(a, 3)) goto failed;
+
+    // Child writes first.
+    if (fork() == 0) {
+        fill(a, 4);
+        ok = squeeze(2 * NPAGES) > 0;
+        ok = check(a, 4) && ok;
+        write(res[1], &ok, 1);
+        exit();
+    }
+    if (read(res[0], &ok, 1) != 1 || !ok) goto failed;
+    wait();
+    if (!check(a, 3)) goto failed;
+
+    printf(stdout, "test 2 ok\n");
+    exit();
+failed:
+    printf(stdout, "test 2 failed!\n");
+    exit();
+}
+
+// Page i holds zeros, a short repeated pattern or
+// pseudo-random bytes, as i % 3 says.
+char pagebyte(int i, int j) {
+    switch (i % 3) {
+    case 0:
+        return 0;
+    case 1:
+        return "swap"[j % 4] + i;
+    default:
+        return (j * 1103515245 + i * 12345) >> 16;
+    }
+}
+
+// Compressed swap: pages that compress well, not at all and to
+// nothing are forced out and must read back unchanged, both
+// when the pool can hold them and when it spills to disk.  The
+// counters must show that they went the way the budget says.
+void test_3(void) {
+    struct vmstat before, out, in;
+    char *a;
+    int   i, j, k, old;
+
+    printf(stdout, "test 3\n");
+
+    a   = sbrk(NPAGES * PGSIZE);
+    old = vmctl(VMCTL_ZBUDGET, -1);
+    for (k = 0; k < 2; k++) {
+        vmctl(VMCTL_ZBUDGET, k == 0 ? ZMAXPAGES : 1);
+        for (i = 0; i < NPAGES; i++)
+            for (j = 0; j < PGSIZE; j++) a[i * PGSIZE + j] = pagebyte(i, j);
+        vmstat(&before);
+        if (squeeze(2 * NPAGES) == 0) goto failed;
+        vmstat(&out);
+        for (i = 0; i < NPAGES; i++)
+            for (j = 0; j < PGSIZE; j++)
+                if (a[i * PGSIZE + j] != pagebyte(i, j)) goto failed;
+        vmstat(&in);
+        if (k == 0 && (out.z_pages <= before.z_pages || in.z_hits == out.z_hits))
+            goto failed;  // not through the pool
+        if (k == 1 && (out.z_spilled == before.z_spilled || in.z_misses == out.z_misses))
+            goto failed;  // not through the disk
+    }
+    vmctl(VMCTL_ZBUDGET, old);
+
+    printf(stdout, "test 3 ok\n");
+    exit();
+failed:
+    vmctl(VMCTL_ZBUDGET, old);
+    printf(stdout, "test 3 failed!\n");
+    exit();
+}
+
+// The faults so far of the calling process, or -1.
+int myfaults(void) {
+    struct vmproc st;
+    int i, pid = getpid();
+
+    for (i = 0; vmproc(i, &st) == 0; i++)
+        if (st.pid == pid) return st.faults;
+    return -1;
+}
+
+// Replacement policies: the same workload runs once under each,
+// and its page faults, swap traffic and time are reported so that
+// the policies can be compared.  Each round touches a hot set,
+// then sweeps the rest once, then has pages squeezed out.
+void test_4(void) {
+    static char *names[] = {"age", "fifo", "clock", "aging"};
+    struct vmstat before, after;
+    char *a, ok;
+    int   pol, old, r, i, faults, start, res[2];
+
+    printf(stdout, "test 4\n");
+
+    old = vmctl(VMCTL_POLICY, -1);
+    if (pipe(res) < 0) goto failed;
+    for (pol = 0; pol < sizeof(names) / sizeof(names[0]); pol++) {
+        if (vmctl(VMCTL_POLICY, pol) < 0) goto failed;
+        if (fork() == 0) {
+            a = sbrk(4 * NPAGES * PGSIZE);
+            for (i = 0; i < 4 * NPAGES; i++) a[i * PGSIZE] = i;
+            vmstat(&before);
+            faults = myfaults();
+            start  = uptime();
+            for (r = 0; r < 8; r++) {
+                for (i = 0; i < NPAGES / 2; i++) a[i * PGSIZE] += 1;
+                for (i = NPAGES / 2; i < 4 * NPAGES; i++) a[i * PGSIZE] += 1;
+                squeeze(NPAGES);
+            }
+            vmstat(&after);
+            printf(stdout, "  %s: %d faults, %d written, %d clean, %d ticks\n",
+                   names[pol], myfaults() - faults, after.swap_writes - before.swap_writes,
+                   after.swap_clean - before.swap_clean, uptime() - start);
+            ok = 1;
+            for (i = 0; i < 4 * NPAGES; i++)
+                if (a[i * PGSIZE] != (char)(i + 8)) ok = 0;
+            write(res[1], &ok, 1);
+            exit();
+        }
+        if (read(res[0], &ok, 1) != 1 || !ok) goto failed;
+        wait();
+    }
+    vmctl(VMCTL_POLICY, old);
+
+    printf(stdout, "test 4 ok\n");
+    exit();
+failed:
+    vmctl(VMCTL_POLICY, old);
+    printf(stdout, "test 4 failed!\n");
+    exit();
+}
+
+void (*tests[])(void) = {test_1, test_2, test_3, test_4};
+
+int main(int argc, char *argv[]) {
+    int i;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (fork() == 0) tests[i]();
+        wait();
+    }
+    exit();
+}
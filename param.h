@@ -7,9 +7,26 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXSEG        4  // max loadable segments in an executable
+#define NPCACHE     128  // pages in the shared executable page cache
+#define VMPOLICY      0  // page-replacement policy at boot, see vmstat.h
+#define AGETICKS     10  // timer ticks between accessed-bit samples
+#define PFFTICKS     10  // faults closer than this grow the frame target
+#define BACKOFFTICKS 10  // ticks kswapd rests after a sweep that freed too little
+#define MINFRAMES    16  // smallest per-process frame target
+#define ZBUDGET      64  // frames for compressed swap at boot
+#define ZMAXPAGES   256  // most frames compressed swap may be given
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (LOGSIZE+4*MAXRUNBLKS)  // size of disk block cache
+#define MAXRUNBLKS   8  // max consecutive blocks in one disk request
+#define NSWAPBUF     8  // swap requests in flight at once
+#define NIDE         4  // disks 0..NIDE-1 are IDE disks
+#define NVIRTIO      2  // disks NIDE..NIDE+NVIRTIO-1 are virtio disks
+#define NSWAPDEV     (NIDE+NVIRTIO)  // disks 0..NSWAPDEV-1 are probed for swap areas
+#define NPCI        32  // most PCI functions remembered by pciinit()
+#define IDEDEADLINE 50  // ticks a disk request waits before it jumps the queue
 #define FSSIZE       1000  // size of file system in blocks
-#define BACKSTORE_START 1000 // start backstore after existing filesystem
-#define BACKSTORE_SIZE ((500 * 1024 * 1024) / 512) // size of  backstore in number of sectors(500 MB)
+#define MAXREADAHEAD 16 // max pages swapped in ahead of one page fault
+#define LOWATER      32 // kswapd wakes when fewer frames than this are free
+#define HIWATER      64 // ... and evicts until this many are free
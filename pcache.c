@@ -0,0 +1,143 @@
+// Shared cache of executable pages.
+//
+// Processes running the same binary map the same frames for
+// the pages of its loadable segments, found here by device,
+// inode number and file offset.  The frames are mapped
+// read-only, so a process that writes one gets its own copy
+// through the copy-on-write fault path.
+//
+// The cache holds a reference to each frame it names.  An entry
+// can be reused, or its frame freed by pcache_shrink(), once the
+// cache holds the only reference.  Writing or truncating a file
+// drops its entries, so a stale page is never handed out.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "vmstat.h"
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;
+  char *mem;  // 0 if the entry is unused
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  uint hand;  // next entry to consider for reuse
+  uint hits;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached frame holding offset off of ip, with a
+// reference taken for the caller, or 0 if it is not cached.
+char*
+pcache_get(struct inode *ip, uint off)
+{
+  struct pcpage *pg;
+  char *mem;
+
+  mem = 0;
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->mem && pg->dev == ip->dev && pg->inum == ip->inum && pg->off == off){
+      kshare(pg->mem);
+      mem = pg->mem;
+      pcache.hits++;
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Enter the frame at mem, just read from offset off of ip,
+// into the cache.  Returns 0, or -1 if no entry is free.
+int
+pcache_put(struct inode *ip, uint off, char *mem)
+{
+  struct pcpage *pg;
+  int i;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++){
+    pg = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(pg->mem && krefcount(pg->mem) > 1)
+      continue;
+    if(pg->mem)
+      kfree(pg->mem);
+    pg->dev = ip->dev;
+    pg->inum = ip->inum;
+    pg->off = off;
+    pg->mem = mem;
+    kshare(mem);
+    release(&pcache.lock);
+    return 0;
+  }
+  release(&pcache.lock);
+  return -1;
+}
+
+// Free the frame of one entry that no process maps.
+// Returns 0, or -1 if there is none.
+int
+pcache_shrink(void)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->mem && krefcount(pg->mem) == 1){
+      kfree(pg->mem);
+      pg->mem = 0;
+      release(&pcache.lock);
+      return 0;
+    }
+  }
+  release(&pcache.lock);
+  return -1;
+}
+
+// Drop the entries for ip, whose contents are changing.
+// Processes that already map the old pages keep them.
+void
+pcache_invalidate(struct inode *ip)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->mem && pg->dev == ip->dev && pg->inum == ip->inum){
+      kfree(pg->mem);
+      pg->mem = 0;
+    }
+  }
+  release(&pcache.lock);
+}
+
+void
+pcache_stat(struct vmstat *st)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  st->text_pages = 0;
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++)
+    if(pg->mem)
+      st->text_pages++;
+  st->text_hits = pcache.hits;
+  release(&pcache.lock);
+}
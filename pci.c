@@ -0,0 +1,104 @@
+// PCI configuration space, reached through configuration
+// mechanism #1: write the address of a register to CONFIG_ADDR,
+// then move its value through CONFIG_DATA.
+//
+// A function is named by a tag, bus<<8 | device<<3 | function.
+// pciinit() walks every bus once and keeps a table of the
+// functions it finds, which drivers then search.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "pci.h"
+
+#define CONFIG_ADDR 0xCF8
+#define CONFIG_DATA 0xCFC
+
+#define PCI_NBUS   256
+#define PCI_NDEV   32
+#define PCI_NFUNC  8
+
+struct pcifunc {
+  int tag;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+};
+
+static struct pcifunc pcifunc[NPCI];
+static int npci;
+
+uint
+pciread(int tag, uint reg)
+{
+  outl(CONFIG_ADDR, 0x80000000 | tag << 8 | (reg & 0xFC));
+  return inl(CONFIG_DATA);
+}
+
+void
+pciwrite(int tag, uint reg, uint v)
+{
+  outl(CONFIG_ADDR, 0x80000000 | tag << 8 | (reg & 0xFC));
+  outl(CONFIG_DATA, v);
+}
+
+void
+pciinit(void)
+{
+  int bus, dev, func, tag;
+  uint id, c;
+  struct pcifunc *f;
+
+  for(bus = 0; bus < PCI_NBUS; bus++){
+    for(dev = 0; dev < PCI_NDEV; dev++){
+      for(func = 0; func < PCI_NFUNC; func++){
+        tag = bus << 8 | dev << 3 | func;
+        if(((id = pciread(tag, PCI_ID)) & 0xFFFF) == 0xFFFF){
+          if(func == 0)
+            break;
+          continue;
+        }
+        if(npci < NPCI){
+          c = pciread(tag, PCI_CLASS);
+          f = &pcifunc[npci++];
+          f->tag = tag;
+          f->vendor = id & 0xFFFF;
+          f->device = id >> 16;
+          f->class = c >> 24;
+          f->subclass = c >> 16;
+        }
+        // Only multi-function devices have functions past 0.
+        if(func == 0 && !(pciread(tag, PCI_HEADER) & 0x800000))
+          break;
+      }
+    }
+  }
+}
+
+// Return the tag of the first function of the given class and
+// subclass, or -1 if there is none.
+int
+pcifind(uint class, uint subclass)
+{
+  struct pcifunc *f;
+
+  for(f = pcifunc; f < &pcifunc[npci]; f++)
+    if(f->class == class && f->subclass == subclass)
+      return f->tag;
+  return -1;
+}
+
+// Return the tag of the n'th function (from 0) with the given
+// vendor and device IDs, or -1 if there is none.
+int
+pcilookup(uint vendor, uint device, int n)
+{
+  struct pcifunc *f;
+
+  for(f = pcifunc; f < &pcifunc[npci]; f++)
+    if(f->vendor == vendor && f->device == device && n-- == 0)
+      return f->tag;
+  return -1;
+}
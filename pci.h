@@ -0,0 +1,19 @@
+// PCI configuration space.
+
+// Registers, as offsets into a function's configuration space.
+#define PCI_ID        0x00  // vendor ID, device ID
+#define PCI_COMMAND   0x04  // command, status
+#define PCI_CLASS     0x08  // revision, prog-if, subclass, class
+#define PCI_HEADER    0x0C  // cache line, latency, header type, BIST
+#define PCI_BAR0      0x10
+#define PCI_BAR(i)    (PCI_BAR0 + 4*(i))
+#define PCI_INTR      0x3C  // interrupt line, pin, min grant, max latency
+
+// Bits in PCI_COMMAND.
+#define PCI_CMD_IO     0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM    0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER 0x4  // bus mastering
+
+// Classes and subclasses.
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_IDE   0x01
@@ -75,32 +75,40 @@ pipeclose(struct pipe *p, int writable)
 }
 
 //PAGEBREAK: 40
+// User memory is only touched without p->lock held, through
+// buf: it may be paged out, and faulting it back in sleeps.
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  char buf[128];
+  int i, m, done;
 
-  acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
+  for(done = 0; done < n; done += m){
+    m = n - done < sizeof(buf) ? n - done : sizeof(buf);
+    memmove(buf, addr + done, m);
+    acquire(&p->lock);
+    for(i = 0; i < m; i++){
+      while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(p->readopen == 0 || myproc()->killed){
+          release(&p->lock);
+          return -1;
+        }
+        wakeup(&p->nread);
+        sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->data[p->nwrite++ % PIPESIZE] = buf[i];
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    release(&p->lock);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
-  release(&p->lock);
   return n;
 }
 
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  char buf[128];
+  int i, done;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,12 +118,17 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(done = 0; done < n && p->nread != p->nwrite; done += i){
+    for(i = 0; i < n - done && i < sizeof(buf); i++){  //DOC: piperead-copy
+      if(p->nread == p->nwrite)
+        break;
+      buf[i] = p->data[p->nread++ % PIPESIZE];
+    }
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+    release(&p->lock);
+    memmove(addr + done, buf, i);
+    acquire(&p->lock);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
-  return i;
+  return done;
 }
@@ -7,6 +7,7 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "backstore.h"
+#include "vmstat.h"
 
 struct {
   struct spinlock lock;
@@ -87,9 +88,15 @@ allocproc(void)
   return 0;
 
 found:
-  p->blist = 0;
   p->alloc = 0;
-  p->code_on_bs = 0;
+  p->ra_next = 0;
+  p->ra_window = 0;
+  p->vmbusy = 0;
+  p->pageout = 0;
+  p->rhead = 0;
+  p->rss = 0;
+  p->target = MINFRAMES;
+  p->last_fault = 0;
   p->state = EMBRYO;
   p->pid = nextpid++;
 
@@ -159,38 +166,57 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Create a kernel thread that runs fn, which must never return.
+// It has no user memory: its page table maps only the kernel.
+struct proc*
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread: no proc");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory?");
+  p->sz = 0;
+  p->elf_size = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  // forkret() returns into fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint old_sz, sz;
-  int ret;
-  uint num_pages = 0;
+  uint sz;
   struct proc *curproc = myproc();
 
   sz = curproc->sz;
   if(sz + n - PGROUNDUP(curproc->elf_size) + 2*PGSIZE > MAX_HEAP_SIZE)
       return -1;
-  old_sz = sz;
+  vmbusy(1);
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
-    num_pages = (PGROUNDUP(sz) - PGROUNDUP(old_sz)) / PGSIZE;
-    for(int i=0; i<num_pages; i++)
-    {
-        memset(curproc->buf, 0, PGSIZE);
-        ret = store_page(curproc, old_sz + i*PGSIZE);
-        if(ret < 0)
-            return -1;
-    }
+    if((sz = allocanon(curproc->pgdir, sz, sz + n)) == 0)
+      goto bad;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+      goto bad;
   }
+  vmbusy(0);
   curproc->sz = sz;
   switchuvm(curproc);
   return 0;
+
+bad:
+  vmbusy(0);
+  return -1;
 }
 
 // Create a new process copying p as the parent.
@@ -209,15 +235,25 @@ fork(void)
   }
 
   // Copy process state from proc.
+  vmbusy(1);
   if((np->pgdir = copyuvm(np, curproc)) == 0){
+    vmbusy(0);
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
+  vmbusy(0);
   np->sz = curproc->sz;
   np->alloc = curproc->alloc;
   np->elf_size = curproc->elf_size;
+  if(curproc->exe){
+    np->exe = idup(curproc->exe);
+    itext(np->exe, 1);
+  }
+  for(i = 0; i < curproc->nseg; i++)
+    np->seg[i] = curproc->seg[i];
+  np->nseg = curproc->nseg;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -230,7 +266,6 @@ fork(void)
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
-  safestrcpy(np->path, curproc->path, sizeof(curproc->path));
 
   pid = np->pid;
 
@@ -268,8 +303,13 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe){
+    itext(curproc->exe, -1);
+    iput(curproc->exe);
+  }
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -314,7 +354,6 @@ wait(void)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
-        free_backstore(p);
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -358,7 +397,7 @@ scheduler(void)
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+      if(p->state != RUNNABLE || p->pageout)
         continue;
 
       // Switch to chosen process.  It is the process's job
@@ -498,6 +537,130 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Mark the current process as in the middle of changing its own
+// page table, possibly asleep on the disk, so that pageout_begin()
+// leaves it alone.
+void
+vmbusy(int busy)
+{
+  acquire(&ptable.lock);
+  myproc()->vmbusy = busy;
+  release(&ptable.lock);
+}
+
+// Stop p so that another thread may evict its pages.  p must be
+// neither running nor in the middle of changing its page table.
+// It will not be scheduled until pageout_end(), so its page table
+// can be changed without racing its own TLB.  Returns 0 if p
+// cannot be stopped now.
+int
+pageout_begin(struct proc *p)
+{
+  int ok;
+
+  acquire(&ptable.lock);
+  ok = (p->state == SLEEPING || p->state == RUNNABLE) &&
+       !p->vmbusy && !p->pageout && p != myproc();
+  if(ok)
+    p->pageout = 1;
+  release(&ptable.lock);
+  return ok;
+}
+// Call fn on each process that pageout_begin() can stop,
+// stopping it for the call.
+void
+pageout_each(void (*fn)(struct proc*))
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(!pageout_begin(p))
+      continue;
+    fn(p);
+    pageout_end(p);
+  }
+}
+
+// Let p run again after pageout_begin().
+void
+pageout_end(struct proc *p)
+{
+  acquire(&ptable.lock);
+  p->pageout = 0;
+  release(&ptable.lock);
+}
+
+// Stop, as pageout_begin() does, up to max processes other than p
+// whose page tables map the frame at pa at va, and record them in
+// who[].  The current process is recorded without being stopped.
+// A process that cannot be stopped now is left out, so callers
+// compare the count with the frame's references.  Returns how
+// many were recorded.
+int
+pageout_mappers(struct proc *p, uint va, uint pa, struct proc **who, int max)
+{
+  struct proc *q;
+  int n, locked;
+
+  // wait() frees a child's page table holding ptable.lock.
+  if(!(locked = holding(&ptable.lock)))
+    acquire(&ptable.lock);
+  n = 0;
+  for(q = ptable.proc; q < &ptable.proc[NPROC] && n < max; q++){
+    if(q == p)
+      continue;
+    if(q != myproc() && ((q->state != SLEEPING && q->state != RUNNABLE) ||
+                         q->vmbusy || q->pageout))
+      continue;
+    if(!mapsframe(q->pgdir, va, pa))
+      continue;
+    if(q != myproc())
+      q->pageout = 1;
+    who[n++] = q;
+  }
+  if(!locked)
+    release(&ptable.lock);
+  return n;
+}
+
+// Fill in st for the i'th process table slot, for vmproc().
+// Returns -1 if there is no such slot.
+int
+proc_vmstat(int i, struct vmproc *st)
+{
+  struct proc *p;
+
+  if(i < 0 || i >= NPROC)
+    return -1;
+  p = &ptable.proc[i];
+  memset(st, 0, sizeof(*st));
+  acquire(&ptable.lock);
+  if(p->state != UNUSED){
+    st->pid = p->pid;
+    safestrcpy(st->name, p->name, sizeof(st->name));
+    st->rss = p->rss;
+    st->target = p->target;
+    st->faults = p->page_fault_count;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Let the n processes pageout_mappers() recorded in who[] run again.
+void
+pageout_endn(struct proc **who, int n)
+{
+  int i, locked;
+
+  if(!(locked = holding(&ptable.lock)))
+    acquire(&ptable.lock);
+  for(i = 0; i < n; i++)
+    if(who[i] != myproc())
+      who[i]->pageout = 0;
+  if(!locked)
+    release(&ptable.lock);
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -548,7 +711,7 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s rss %d/%d", p->pid, state, p->name, p->rss, p->target);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -37,6 +37,15 @@ struct context {
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
+// A loadable segment of a process's executable, read in
+// page by page at page faults.
+struct segment {
+  uint vaddr;
+  uint off;                    // Offset in the executable
+  uint filesz;
+  uint memsz;
+};
+
 struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
@@ -52,13 +61,21 @@ struct proc {
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   uint elf_size;
-  char buf[PGSIZE];
-  char path[20];
+  struct inode *exe;           // Executable, for loading text and data
+  struct segment seg[MAXSEG];  // Its loadable segments
+  int nseg;
   uint alloc;
-  uint code_on_bs;
   uint page_fault_count;
   uint page_inserted;
-  struct backstore_frame* blist;
+  uint ra_next;                // va a sequential page fault would hit next
+  uint ra_window;              // pages to swap in ahead of that fault
+  int vmbusy;                  // If non-zero, changing its own page table
+  int pageout;                 // If non-zero, another thread is evicting its pages
+  uint rhead;                  // Frame number of a resident page, 0 if none
+  uint rss;                    // Number of resident pages
+  uint target;                 // Resident pages it should get under pressure
+  uint last_fault;             // ticks at its last page fault
+  uint nosweep;                // replace_global() sweep that could not stop it
 };
 
 // Process memory is laid out contiguously, low addresses first:
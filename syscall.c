@@ -104,6 +104,9 @@ extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_lseek(void);
+extern int sys_vmstat(void);
+extern int sys_vmctl(void);
+extern int sys_vmproc(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -128,6 +131,9 @@ static int (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_lseek]   sys_lseek,
+[SYS_vmstat]  sys_vmstat,
+[SYS_vmctl]   sys_vmctl,
+[SYS_vmproc]  sys_vmproc,
 };
 
 void
@@ -21,3 +21,6 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_lseek  22
+#define SYS_vmstat 23
+#define SYS_vmctl  24
+#define SYS_vmproc 25
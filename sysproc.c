@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "vmstat.h"
 
 int
 sys_fork(void)
@@ -89,3 +90,50 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// fill in paging statistics.
+int
+sys_vmstat(void)
+{
+  struct vmstat *ust, st;
+
+  if(argptr(0, (void*)&ust, sizeof(*ust)) < 0)
+    return -1;
+  // Gather into a kernel copy: the collectors hold spinlocks, and
+  // the user's page may be paged out.
+  memset(&st, 0, sizeof(st));
+  backstore_stat(&st);
+  vm_stat(&st);
+  pcache_stat(&st);
+  zswap_stat(&st);
+  ide_stat(&st);
+  virtio_stat(&st);
+  memmove(ust, &st, sizeof(st));
+  return 0;
+}
+
+// read or set a paging tunable.
+int
+sys_vmctl(void)
+{
+  int cmd, val;
+
+  if(argint(0, &cmd) < 0 || argint(1, &val) < 0)
+    return -1;
+  return vm_ctl(cmd, val);
+}
+
+// resident set of the process in table slot i.
+int
+sys_vmproc(void)
+{
+  struct vmproc *ust, st;
+  int i;
+
+  if(argint(0, &i) < 0 || argptr(1, (void*)&ust, sizeof(*ust)) < 0)
+    return -1;
+  if(proc_vmstat(i, &st) < 0)
+    return -1;
+  memmove(ust, &st, sizeof(st));
+  return 0;
+}
@@ -53,15 +53,19 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      vm_tick();
     }
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
-    ideintr();
+    ideintr(0);
     lapiceoi();
     break;
-  case T_IRQ0 + IRQ_IDE+1:
-    // Bochs generates spurious IDE1 interrupts.
+  case T_IRQ0 + IRQ_IDE2:
+    // Bochs generates spurious IDE1 interrupts; ideintr() ignores
+    // them when the channel has no command in progress.
+    ideintr(1);
+    lapiceoi();
     break;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
@@ -84,6 +88,12 @@ trap(struct trapframe *tf)
     break;
   //PAGEBREAK: 13
   default:
+    // PCI devices get whatever IRQ the BIOS routed them to.
+    if(tf->trapno >= T_IRQ0 && tf->trapno < T_IRQ0 + 32 &&
+       virtio_intr(tf->trapno - T_IRQ0)){
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct vmstat;
+struct vmproc;
 
 // system calls
 int fork(void);
@@ -23,6 +25,9 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int vmstat(struct vmstat*);
+int vmctl(int, int);
+int vmproc(int, struct vmproc*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -0,0 +1,412 @@
+// Driver for virtio block devices on PCI, through the legacy
+// (virtio 0.9.5) interface that QEMU's transitional devices
+// offer in I/O space.
+//
+// Each disk has one virtqueue: a table of descriptors, each
+// naming a piece of memory, an available ring through which the
+// driver hands chains of descriptors to the device, and a used
+// ring through which the device hands them back when done.  A
+// request is a chain of a header, the data, and a status byte,
+// so the data of a multi-block request may be scattered over
+// several bufs.  Unlike IDE the device takes requests while
+// others are in progress, so the driver does not queue them
+// itself: it gives each one to the device as soon as there are
+// descriptors for it, and the device decides the order.
+//
+// Virtio disk i is disk NIDE+i.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "vmstat.h"
+
+#define VIRTIO_VENDOR   0x1AF4
+#define VIRTIO_BLK      0x1001  // transitional block device
+
+// Legacy registers, as offsets from the I/O BAR.
+#define VIRTIO_HOST_FEATURES  0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_PFN      0x08
+#define VIRTIO_QUEUE_NUM      0x0C
+#define VIRTIO_QUEUE_SEL      0x0E
+#define VIRTIO_QUEUE_NOTIFY   0x10
+#define VIRTIO_STATUS         0x12
+#define VIRTIO_ISR            0x13
+#define VIRTIO_CONFIG         0x14  // device config; for a disk, its capacity
+
+// Bits in VIRTIO_STATUS.
+#define VIRTIO_ACK        0x01
+#define VIRTIO_DRIVER     0x02
+#define VIRTIO_DRIVER_OK  0x04
+#define VIRTIO_FAILED     0x80
+
+#define VRING_F_NEXT   1  // chain continues with desc.next
+#define VRING_F_WRITE  2  // device writes, rather than reads, the memory
+
+#define VIRTIO_BLK_IN   0  // read
+#define VIRTIO_BLK_OUT  1  // write
+#define VIRTIO_BLK_OK   0
+
+#define SECTOR_SIZE   512
+
+struct vdesc {
+  uint addr;
+  uint addr_hi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vavail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vused {
+  ushort flags;
+  ushort idx;
+  struct {
+    uint id;
+    uint len;
+  } ring[];
+};
+
+// The queue's size is set by the device; VQMAX is the most this
+// driver takes.  The device finds the rings from the queue's
+// page number, so they must sit in physically contiguous memory
+// laid out as the legacy interface demands: descriptors, then
+// the available ring, then on the next page the used ring.
+#define VQMAX       256
+#define VAVAILOFF(n)  (16*(n))
+#define VUSEDOFF(n)   PGROUNDUP(16*(n) + 6 + 2*(n))
+#define VRINGSIZE   (VUSEDOFF(VQMAX) + PGROUNDUP(6 + 8*VQMAX))
+
+// Descriptors in the longest request: header, data, status.
+#define VMAXDESC    (MAXRUNBLKS + 2)
+
+struct vreq {
+  struct {
+    uint type;
+    uint reserved;
+    uint sector;
+    uint sector_hi;
+  } hdr;
+  uchar status;
+  struct buf *b;
+};
+
+struct vdisk {
+  // The device takes the ring's page number, so it must start a
+  // page; aligning it also rounds the struct up to whole pages,
+  // which keeps every vdisk[] element's ring aligned.
+  uchar ring[VRINGSIZE] __attribute__((aligned(PGSIZE)));
+  struct spinlock lock;
+  int present;
+  uint io;                 // I/O BAR
+  uint irq;
+  uint qsize;
+  uint capacity;           // in sectors
+  struct vdesc *desc;
+  struct vavail *avail;
+  struct vused *used;
+  ushort usedidx;          // next used entry to look at
+  ushort free[VQMAX];      // stack of free descriptors
+  uint nfree;
+  struct vreq req[VQMAX];  // by the request's first descriptor
+  uint requests;           // statistics
+  uint depth;
+  uint maxdepth;
+};
+
+static struct vdisk vdisk[NVIRTIO];
+
+// The virtio disk of dev, or 0 if there is no such disk.
+static struct vdisk*
+vdiskof(uint dev)
+{
+  if(dev < NIDE || dev >= NIDE + NVIRTIO || !vdisk[dev - NIDE].present)
+    return 0;
+  return &vdisk[dev - NIDE];
+}
+
+static int
+vsetup(struct vdisk *d, int tag)
+{
+  uint bar, i;
+
+  bar = pciread(tag, PCI_BAR0);
+  if(!(bar & 1))
+    return -1;
+  d->io = bar & ~3;
+  d->irq = pciread(tag, PCI_INTR) & 0xFF;
+  if(d->irq == 0 || d->irq == 0xFF)
+    return -1;
+  pciwrite(tag, PCI_COMMAND, pciread(tag, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+
+  outb(d->io + VIRTIO_STATUS, 0);  // reset
+  outb(d->io + VIRTIO_STATUS, VIRTIO_ACK);
+  outb(d->io + VIRTIO_STATUS, VIRTIO_ACK | VIRTIO_DRIVER);
+  outl(d->io + VIRTIO_GUEST_FEATURES, 0);  // none needed
+
+  outw(d->io + VIRTIO_QUEUE_SEL, 0);
+  d->qsize = inw(d->io + VIRTIO_QUEUE_NUM);
+  if(d->qsize == 0 || d->qsize > VQMAX || inl(d->io + VIRTIO_QUEUE_PFN) != 0){
+    outb(d->io + VIRTIO_STATUS, VIRTIO_FAILED);
+    return -1;
+  }
+  memset(d->ring, 0, sizeof(d->ring));
+  d->desc = (struct vdesc*)d->ring;
+  d->avail = (struct vavail*)(d->ring + VAVAILOFF(d->qsize));
+  d->used = (struct vused*)(d->ring + VUSEDOFF(d->qsize));
+  d->usedidx = 0;
+  for(i = 0; i < d->qsize; i++)
+    d->free[i] = i;
+  d->nfree = d->qsize;
+  outl(d->io + VIRTIO_QUEUE_PFN, V2P(d->ring) / PGSIZE);
+
+  d->capacity = inl(d->io + VIRTIO_CONFIG);
+  if(inl(d->io + VIRTIO_CONFIG + 4) != 0)
+    d->capacity = ~0;  // more than we can address
+  outb(d->io + VIRTIO_STATUS, VIRTIO_ACK | VIRTIO_DRIVER | VIRTIO_DRIVER_OK);
+  return 0;
+}
+
+void
+virtioinit(void)
+{
+  struct vdisk *d;
+  int i, tag;
+
+  for(i = 0; i < NVIRTIO; i++){
+    d = &vdisk[i];
+    initlock(&d->lock, "virtio");
+    if((tag = pcilookup(VIRTIO_VENDOR, VIRTIO_BLK, i)) < 0)
+      continue;
+    if(vsetup(d, tag) < 0){
+      cprintf("virtio%d: cannot set up device\n", i);
+      continue;
+    }
+    d->present = 1;
+    ioapicenable(d->irq, (ncpu - 1) - i % ncpu);
+    cprintf("virtio%d: disk %d, %d sectors, queue %d, irq %d\n",
+            i, NIDE + i, d->capacity, d->qsize, d->irq);
+  }
+}
+
+// Give b's request, and those of the bufs on b->mnext, to the
+// device as one chain.  Caller holds d->lock and has checked that
+// there are enough free descriptors.
+static void
+vsubmit(struct vdisk *d, struct buf *b)
+{
+  struct vreq *r;
+  struct vdesc *v;
+  struct buf *m;
+  uint head, i, n, write;
+
+  write = (b->flags & B_DIRTY) != 0;
+  n = 0;
+  for(m = b; m; m = m->mnext)
+    n += m->page ? PGSIZE/SECTOR_SIZE : BSIZE/SECTOR_SIZE;
+  if(b->blockno * (BSIZE/SECTOR_SIZE) + n > d->capacity)
+    panic("virtio: block out of range");
+
+  head = d->free[--d->nfree];
+  r = &d->req[head];
+  r->hdr.type = write ? VIRTIO_BLK_OUT : VIRTIO_BLK_IN;
+  r->hdr.reserved = 0;
+  r->hdr.sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  r->hdr.sector_hi = 0;
+  r->status = 0xFF;
+  r->b = b;
+
+  v = &d->desc[head];
+  v->addr = V2P(&r->hdr);
+  v->len = sizeof(r->hdr);
+  v->flags = VRING_F_NEXT;
+  for(m = b; m; m = m->mnext){
+    v->next = i = d->free[--d->nfree];
+    v = &d->desc[i];
+    v->addr = V2P(m->page ? m->page : m->data);
+    v->len = m->page ? PGSIZE : BSIZE;
+    v->flags = VRING_F_NEXT | (write ? 0 : VRING_F_WRITE);
+  }
+  v->next = i = d->free[--d->nfree];
+  v = &d->desc[i];
+  v->addr = V2P(&r->status);
+  v->len = 1;
+  v->flags = VRING_F_WRITE;
+
+  // The device must see the chain before it sees the ring entry,
+  // and the ring entry before the new index.
+  d->avail->ring[d->avail->idx % d->qsize] = head;
+  __sync_synchronize();
+  d->avail->idx++;
+  __sync_synchronize();
+  outw(d->io + VIRTIO_QUEUE_NOTIFY, 0);
+
+  d->requests++;
+  if(++d->depth > d->maxdepth)
+    d->maxdepth = d->depth;
+}
+
+// Retire the requests the device has finished.
+// Caller holds d->lock.
+static void
+vcomplete(struct vdisk *d)
+{
+  struct vreq *r;
+  struct buf *m;
+  uint i;
+
+  __sync_synchronize();
+  while(d->usedidx != *(volatile ushort*)&d->used->idx){
+    i = d->used->ring[d->usedidx % d->qsize].id;
+    r = &d->req[i];
+    if(r->status != VIRTIO_BLK_OK){
+      cprintf("virtio: disk %d sector %d status %d\n",
+              NIDE + (int)(d - vdisk), r->hdr.sector, r->status);
+      panic("virtio: disk error");
+    }
+    for(m = r->b; m; m = m->mnext){
+      m->flags |= B_VALID;
+      m->flags &= ~B_DIRTY;
+    }
+    biodone(r->b);
+    r->b = 0;
+    for(;;){
+      d->free[d->nfree++] = i;
+      if(!(d->desc[i].flags & VRING_F_NEXT))
+        break;
+      i = d->desc[i].next;
+    }
+    d->depth--;
+    d->usedidx++;
+  }
+  wakeup(&d->nfree);
+}
+
+// Interrupt handler for IRQ irq.  Returns 1 if it belongs to a
+// virtio disk.
+int
+virtio_intr(int irq)
+{
+  struct vdisk *d;
+  int mine;
+
+  mine = 0;
+  for(d = vdisk; d < &vdisk[NVIRTIO]; d++){
+    if(!d->present || d->irq != irq)
+      continue;
+    mine = 1;
+    acquire(&d->lock);
+    inb(d->io + VIRTIO_ISR);  // acknowledge
+    vcomplete(d);
+    release(&d->lock);
+  }
+  return mine;
+}
+
+// Read block blockno of disk dev into dst, polling for the
+// result.  Only for use at boot, before there is a process to
+// sleep in virtio_rw().
+// Returns -1 if there is no such disk.
+int
+virtio_read(uint dev, uint blockno, uchar *dst)
+{
+  static struct buf b;
+  struct vdisk *d;
+
+  if((d = vdiskof(dev)) == 0)
+    return -1;
+  acquire(&d->lock);
+  b.dev = dev;
+  b.blockno = blockno;
+  b.flags = 0;
+  b.mnext = 0;
+  b.page = 0;
+  vsubmit(d, &b);
+  while(!(b.flags & B_VALID))
+    vcomplete(d);
+  inb(d->io + VIRTIO_ISR);
+  release(&d->lock);
+  memmove(dst, b.data, BSIZE);
+  return 0;
+}
+
+// Give a request to sync buf with disk, as idesubmit() takes, to
+// the device, and return without waiting for it.  Sleeps until
+// there are enough free descriptors.
+void
+virtio_submit(struct buf *b)
+{
+  struct vdisk *d;
+  struct buf *m;
+  uint n;
+
+  n = 2;
+  for(m = b; m; m = m->mnext){
+    if(!holdingsleep(&m->lock))
+      panic("virtio_submit: buf not locked");
+    if((m->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("virtio_submit: nothing to do");
+    if(m != b && (m->dev != b->dev || (m->flags & B_DIRTY) != (b->flags & B_DIRTY)))
+      panic("virtio_submit: mixed request");
+    if(m->mnext && m->mnext->blockno != m->blockno + 1)
+      panic("virtio_submit: blocks not consecutive");
+    n++;
+  }
+  if(b->page && b->mnext)
+    panic("virtio_submit: page request with mnext");
+  if(n > VMAXDESC)
+    panic("virtio_submit: request too long");
+  if((d = vdiskof(b->dev)) == 0)
+    panic("virtio_submit: no such disk");
+
+  acquire(&d->lock);
+  while(d->nfree < n)
+    sleep(&d->nfree, &d->lock);
+  vsubmit(d, b);
+  release(&d->lock);
+}
+
+// Sync buf with disk, as iderw() does.
+void
+virtio_rw(struct buf *b)
+{
+  struct vdisk *d;
+
+  virtio_submit(b);
+
+  d = vdiskof(b->dev);
+  acquire(&d->lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &d->lock);
+  release(&d->lock);
+}
+
+// Add the virtio disks' counts to those ide_stat() gathered.
+void
+virtio_stat(struct vmstat *st)
+{
+  struct vdisk *d;
+
+  for(d = vdisk; d < &vdisk[NVIRTIO]; d++){
+    acquire(&d->lock);
+    st->io_requests += d->requests;
+    st->io_commands += d->requests;
+    st->io_depth += d->depth;
+    st->io_maxdepth += d->maxdepth;
+    release(&d->lock);
+  }
+}
@@ -5,17 +5,152 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
-#include "elf.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "buf.h"
 #include "backstore.h"
 #include "file.h"
+#include "vmstat.h"
 
 extern char data[];  // defined by kernel.ld
+extern char end[];   // first address after kernel loaded from ELF file
 pde_t *kpgdir;  // for use in scheduler()
 
+// Readahead counters, reported by vm_stat().
+static uint ra_pages, ra_hits, ra_wasted;
+
+// Pages evicted by faulting processes themselves.
+static uint direct_pages;
+
+// Evicted pages written to the backstore, and evicted pages whose
+// slot still held an up-to-date copy, so were not written, and
+// evicted text pages dropped to be read from the executable again.
+static uint swap_writes, swap_clean, text_dropped;
+
+// The page-out daemon.  kalloc() wakes it when fewer than
+// lowater frames are free, and it evicts pages until hiwater
+// frames are free, so that page faults find a frame waiting.
+// After a sweep that could not get there it rests, see
+// kswapd_resting().
+static struct {
+  struct spinlock lock;
+  struct proc *proc;
+  int wanted;          // kalloc() saw free frames below lowater
+  int sample;          // vm_tick() asked for the periodic sample
+  int stuck;           // the last sweep fell short of hiwater
+  uint stucktick;      // ... at this tick
+  uint stuckfree;      // ... with this many frames free
+  uint lowater;
+  uint hiwater;
+  uint wakeups;        // times it went to work
+  uint pages;          // pages it evicted
+} kswapd;
+
+// The physical frame table, indexed by physical page number.
+// frameinit() places it in memory just above the first 4MB.
+// Each frame between end and PHYSTOP that holds a user page
+// names the process and page table mapping it and where; the
+// page's age is in that PTE.  A frame shared copy-on-write
+// belongs to one of the page tables that map it, and passes to
+// another when that one lets it go.  replace_global() sweeps the
+// table with a clock hand, and each process's resident frames
+// are linked in a ring from p->rhead for replace_page().  A page swapped in keeps its slot
+// in the frame table, so it can be evicted again without a write
+// as long as its PTE_D stays clear; a page read from the
+// executable is dropped and read from there again.
+#define FIRSTFRAME PGROUNDUP(V2P(end))
+struct frame {
+  struct proc *owner;  // 0 if not a user page
+  pde_t *pgdir;        // owner's page table when it mapped the frame
+  uint va;
+  uint next, prev;     // owner's resident ring, as frame numbers
+  int slot;            // backstore slot still holding a copy, or -1
+  int text;            // read from the executable
+  uchar age8;          // aging register, see aging_pick()
+};
+static struct {
+  struct spinlock lock;  // protects hand
+  uint hand;             // physical address of the next frame to visit
+  uint sweeps;           // replace_global() calls, numbering them
+  struct frame *frame;   // PHYSTOP/PGSIZE entries
+} ftable;
+
+// Where evict() lists the processes mapping a shared frame, and
+// their PTEs; the lists are too big for a kernel stack.  Held
+// across the page's write to the backstore.
+static struct {
+  struct sleeplock lock;
+  struct proc *who[NPROC];
+  pte_t *pt[NPROC];
+} sharers;
+
+// Page-replacement policies.  A victim scan visits resident pages
+// in clock order, making up to NPASS passes, and asks pick() about
+// each page; pick() may update the page's reference state and
+// returns non-zero to evict the page.  Every policy must pick any
+// page by the last pass.  If sample() is set, the page-out daemon
+// calls it on the resident pages of every stopped process each
+// AGETICKS timer ticks.
+#define NPASS 9
+struct policy {
+  int (*pick)(pte_t*, struct frame*, int);
+  void (*sample)(pte_t*, struct frame*);
+};
+
+// A 3-bit age in PTE_ALLOC, seeded at fault time from how many
+// pages the process has faulted in and counted down each time a
+// scan passes the page.
+static int
+age_pick(pte_t *pte, struct frame *f, int pass){
+    uint age = PTE_ALLOC(*pte) >> 9;
+    if(age == 0)
+	return 1;
+    *pte = (*pte & ~GETALLOC(7)) | GETALLOC((age - 1));
+    return 0;
+}
+// First in, first out.  New pages join a resident ring just
+// behind the hand, so the hand meets them in load order.
+static int
+fifo_pick(pte_t *pte, struct frame *f, int pass){
+    return 1;
+}
+// Second chance: a page the hardware has marked accessed since
+// the hand last passed it loses PTE_A and is kept.
+static int
+clock_pick(pte_t *pte, struct frame *f, int pass){
+    if(*pte & PTE_A){
+	*pte &= ~PTE_A;
+	return 0;
+    }
+    return 1;
+}
+// Aging: each sample shifts PTE_A into the top of an 8-bit
+// register.  Pass n takes pages whose register is below 2^n, so
+// pages unused for longest go first.
+static int
+aging_pick(pte_t *pte, struct frame *f, int pass){
+    return f->age8 < (1 << pass);
+}
+static void
+aging_sample(pte_t *pte, struct frame *f){
+    f->age8 = (f->age8 >> 1) | ((*pte & PTE_A) ? 0x80 : 0);
+    *pte &= ~PTE_A;
+}
+
+static struct policy policies[] = {
+[VMPOLICY_AGE]   { age_pick, 0 },
+[VMPOLICY_FIFO]  { fifo_pick, 0 },
+[VMPOLICY_CLOCK] { clock_pick, 0 },
+[VMPOLICY_AGING] { aging_pick, aging_sample },
+};
+static int vmpolicy = VMPOLICY;
+
+static void ra_account(pte_t*, int);
+static void setframe(char*, struct proc*, uint);
+static void dropframe(char*, pde_t*);
+static int evict(struct proc*, uint);
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -245,6 +380,48 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Like allocuvm, but for anonymous memory: the pages are marked
+// PTE_ZERO and get a zeroed frame when first touched.
+int
+allocanon(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  uint a;
+
+  if(newsz >= KERNBASE)
+    return 0;
+  if(newsz < oldsz)
+    return oldsz;
+
+  for(a = PGROUNDUP(oldsz); a < newsz; a += PGSIZE){
+    if(mappages(pgdir, (char*)a, PGSIZE, 0, PTE_W|PTE_U|PTE_ZERO, 0) < 0){
+      cprintf("allocanon out of memory\n");
+      return 0;
+    }
+  }
+  return newsz;
+}
+
+// Map the frame at mem as p's resident page at va, whose PTE
+// must already exist.
+void
+mapframe(struct proc *p, uint va, char *mem)
+{
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U|PTE_P, 0) < 0)
+    panic("mapframe");
+  setframe(mem, p, va);
+}
+
+// Does pgdir map the frame at physical address pa at va?
+int
+mapsframe(pde_t *pgdir, uint va, uint pa)
+{
+  pte_t *pte;
+
+  if(pgdir == 0 || (pte = walkpgdir(pgdir, (char*)va, 0)) == 0)
+    return 0;
+  return (*pte & PTE_P) && PTE_ADDR(*pte) == pa;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -264,13 +441,19 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
     else if((*pte & PTE_P) != 0){
+      ra_account(pte, 1);
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
       char *v = P2V(pa);
+      dropframe(v, pgdir);
       kfree(v);
       *pte = 0;
     }
+    else if(*pte & PTE_SWAP){
+      backstore_free(PTE_SLOT(*pte));
+      *pte = 0;
+    }
   }
   return newsz;
 }
@@ -317,52 +500,43 @@ clearptep(pde_t *pgdir, char *uva)
   *pte &= ~PTE_P;
 }
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Resident pages are shared copy-on-write:
+// both page tables map them read-only, and cow_page() copies
+// one when it is written.  Swapped-out pages share the parent's
+// backstore slot, so fork does no disk I/O.
 pde_t*
 copyuvm(struct proc* dest, struct proc* src)
 {
   pde_t *d;
   pte_t *pte;
-  uint pa = 0, flags = 0, i;
-  char *mem = 0;
-  int alloc = 0;
+  uint pa, flags, i;
+  int alloc;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < src->elf_size; i += PGSIZE){
+  for(i = 0; i < src->sz; i += PGSIZE){
     if((pte = walkpgdir(src->pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");
     if(!(*pte & PTE_P)){
-        if(mappages(d, (char*)i, PGSIZE, V2P(mem), PTE_W | PTE_U, 0) < 0)
-            goto bad;
+      if(mappages(d, (char*)i, PGSIZE, PTE_ADDR(*pte), PTE_FLAGS(*pte), PTE_ALLOC(*pte)) < 0)
+        goto bad;
+      if(*pte & PTE_SWAP)
+        backstore_share(PTE_SLOT(*pte));
+      continue;
     }
-    else{
     pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
+    *pte &= ~PTE_W;
+    flags = PTE_FLAGS(*pte) & ~PTE_RA;
     alloc = PTE_ALLOC(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    }
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags, alloc) < 0) {
-      kfree(mem);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags, alloc) < 0)
       goto bad;
-    }
-  }
-  pte = walkpgdir(src->pgdir, (char *)(PGROUNDUP(src->elf_size) + PGSIZE), 0);
-  if(*pte & PTE_P){
-      memmove(dest->buf, (char *)(PGROUNDUP(src->elf_size) + PGSIZE), PGSIZE);
-      if(store_page(dest, (PGROUNDUP(src->elf_size) + PGSIZE)) < 0)
-          panic("no space to store stack in backstore\n");
-  }
-  else{
-      load_frame(dest->buf, (char *)(PGROUNDUP(src->elf_size) + PGSIZE));
-      if(store_page(dest, (PGROUNDUP(src->elf_size) + PGSIZE)) < 0)
-          panic("no space to store stack in backstore\n");
+    kshare(P2V(pa));
   }
+  lcr3(V2P(src->pgdir));  // src is the current process
   return d;
 
 bad:
+  lcr3(V2P(src->pgdir));
   freevm(d);
   return 0;
 }
@@ -408,6 +582,401 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+// Resize p's readahead window for a page fault at va.  The
+// window doubles while faults keep landing just past the pages
+// already brought in, and halves when they land anywhere else.
+static void
+ra_resize(struct proc *p, uint va){
+    if(va == p->ra_next){
+	if(p->ra_window == 0)
+	    p->ra_window = 1;
+	else if(p->ra_window < MAXREADAHEAD)
+	    p->ra_window *= 2;
+    }
+    else
+	p->ra_window /= 2;
+    p->ra_next = va + PGSIZE;
+}
+// Swap in up to p->ra_window pages following va, stopping at the
+// first one that is not in the backstore.  Readahead never evicts:
+// it stops when no frame is free.  The reads are all started
+// before any is waited for, and the pages are mapped once they
+// are in, with PTE_RA so that ra_account() can tell whether they
+// were worth reading.
+static void
+swapin_ahead(struct proc *p, uint va, uint alloc){
+    struct biobatch bb;
+    char *mem[MAXREADAHEAD];
+    pte_t *pte;
+    uint i, n, slot;
+    binitbatch(&bb);
+    for(n = 0; n < p->ra_window && n < MAXREADAHEAD; n++){
+	if(va + (n + 1) * PGSIZE >= p->sz)
+	    break;
+	if((pte = walkpgdir(p->pgdir, (char *)(va + (n + 1) * PGSIZE), 0)) == 0)
+	    break;
+	if((*pte & (PTE_P | PTE_SWAP)) != PTE_SWAP)
+	    break;
+	if((mem[n] = kalloc()) == 0)
+	    break;
+	backstore_read_async(PTE_SLOT(*pte), mem[n], &bb);
+    }
+    bwait(&bb);
+    for(i = 0; i < n; i++){
+	va += PGSIZE;
+	pte = walkpgdir(p->pgdir, (char *)va, 0);
+	slot = PTE_SLOT(*pte);
+	*pte &= PTE_W | PTE_U;
+	if(mappages(p->pgdir, (char *)va, PGSIZE, V2P(mem[i]), PTE_W | PTE_U | PTE_P | PTE_RA, alloc) < 0)
+	    panic("mappages");
+	setframe(mem[i], p, va);
+	ftable.frame[V2P(mem[i]) / PGSIZE].slot = slot;
+	ra_pages++;
+	p->ra_next = va + PGSIZE;
+    }
+}
+// Settle the readahead mark of a resident page: a hit once the
+// hardware has seen the page used, wasted if the page is leaving
+// memory without having been used.
+static void
+ra_account(pte_t *pte, int leaving){
+    if(!(*pte & PTE_RA))
+	return;
+    if(*pte & PTE_A)
+	ra_hits++;
+    else if(leaving)
+	ra_wasted++;
+    else
+	return;
+    *pte &= ~PTE_RA;
+}
+void vm_stat(struct vmstat *st){
+    st->ra_pages = ra_pages;
+    st->ra_hits = ra_hits;
+    st->ra_wasted = ra_wasted;
+    st->free_pages = kfreecount();
+    st->lowater = kswapd.lowater;
+    st->hiwater = kswapd.hiwater;
+    st->kswapd_wakeups = kswapd.wakeups;
+    st->kswapd_pages = kswapd.pages;
+    st->direct_pages = direct_pages;
+    st->swap_writes = swap_writes;
+    st->swap_clean = swap_clean;
+    st->text_dropped = text_dropped;
+    st->policy = vmpolicy;
+}
+// Read or set a paging tunable.  A negative val only reads it.
+// Returns the old value, or -1 if cmd or val is bad.
+int vm_ctl(int cmd, int val){
+    uint *t, old;
+    switch(cmd){
+    case VMCTL_ZBUDGET:
+	return zswap_budget(val);
+    case VMCTL_POLICY:
+	old = vmpolicy;
+	if(val >= (int)NELEM(policies))
+	    return -1;
+	if(val >= 0)
+	    vmpolicy = val;
+	return old;
+    case VMCTL_LOWATER:
+	t = &kswapd.lowater;
+	break;
+    case VMCTL_HIWATER:
+	t = &kswapd.hiwater;
+	break;
+    default:
+	return -1;
+    }
+    acquire(&kswapd.lock);
+    old = *t;
+    if(val >= 0){
+	*t = val;
+	if(kswapd.lowater > kswapd.hiwater){
+	    *t = old;
+	    old = -1;
+	}
+    }
+    release(&kswapd.lock);
+    return old;
+}
+// After a sweep that fell short, nothing is likely to be evictable
+// until frames are freed or processes move on, so the daemon is
+// not sent again before one of those, and does not take the CPU
+// from the processes it is meant to help.  Called with
+// kswapd.lock held.
+static int
+kswapd_resting(uint nfree){
+    return kswapd.stuck && ticks - kswapd.stucktick < BACKOFFTICKS &&
+	nfree <= kswapd.stuckfree;
+}
+// Called by kalloc() with the number of free frames left.
+void kswapd_wakeup(uint nfree){
+    if(kswapd.proc == 0 || nfree >= kswapd.lowater)
+	return;
+    acquire(&kswapd.lock);
+    if(!kswapd.wanted && !kswapd_resting(nfree)){
+	kswapd.wanted = 1;
+	wakeup(&kswapd);
+    }
+    release(&kswapd.lock);
+}
+// Called on every timer tick.  Every AGETICKS ticks, asks the
+// daemon to look at each process, see sample_proc().
+void vm_tick(void){
+    if(kswapd.proc == 0 || ticks % AGETICKS)
+	return;
+    acquire(&kswapd.lock);
+    kswapd.sample = 1;
+    wakeup(&kswapd);
+    release(&kswapd.lock);
+}
+// Periodic work on a stopped process: shrink the frame target of
+// one that has not faulted lately, so that an idle process gives
+// frames back, and sample accessed bits for the policy.
+static void
+sample_proc(struct proc *p){
+    struct frame *f;
+    pte_t *pte;
+    uint n, fi;
+    void (*sample)(pte_t*, struct frame*) = policies[vmpolicy].sample;
+    if(ticks - p->last_fault >= PFFTICKS && p->target > MINFRAMES)
+	p->target -= (p->target - MINFRAMES + 7) / 8;
+    if(sample == 0)
+	return;
+    for(n = p->rss, fi = p->rhead; n > 0; n--, fi = f->next){
+	f = &ftable.frame[fi];
+	if((pte = walkpgdir(p->pgdir, (void *)f->va, 0)) != 0 && (*pte & PTE_P))
+	    sample(pte, f);
+    }
+}
+// Evict pages of a stopped process beyond its frame target
+// while frames are short.
+static void
+trim_proc(struct proc *p){
+    while(p->rss > p->target && kfreecount() < kswapd.hiwater && replace_page(p) == 0)
+	kswapd.pages++;
+}
+// The daemon's kernel thread.  When frames run short it first
+// trims processes over their targets, then sweeps the global clock.
+static void
+kswapd_run(void){
+    int wanted, sample, rest;
+    uint nfree;
+    for(;;){
+	acquire(&kswapd.lock);
+	while(!kswapd.wanted && !kswapd.sample)
+	    sleep(&kswapd, &kswapd.lock);
+	wanted = kswapd.wanted;
+	sample = kswapd.sample;
+	kswapd.wanted = 0;
+	kswapd.sample = 0;
+	if(wanted)
+	    kswapd.wakeups++;
+	release(&kswapd.lock);
+	if(sample)
+	    pageout_each(sample_proc);
+	nfree = kfreecount();
+	acquire(&kswapd.lock);
+	rest = kswapd_resting(nfree);
+	release(&kswapd.lock);
+	if(rest || nfree >= kswapd.hiwater)
+	    continue;
+	pageout_each(trim_proc);
+	while(kfreecount() < kswapd.hiwater && (pcache_shrink() == 0 || replace_global() == 0))
+	    kswapd.pages++;
+	nfree = kfreecount();
+	acquire(&kswapd.lock);
+	if((kswapd.stuck = nfree < kswapd.hiwater)){
+	    kswapd.stucktick = ticks;
+	    kswapd.stuckfree = nfree;
+	}
+	release(&kswapd.lock);
+    }
+}
+void kswapdinit(void){
+    initlock(&kswapd.lock, "kswapd");
+    kswapd.lowater = LOWATER;
+    kswapd.hiwater = HIWATER;
+    kswapd.proc = kthread("kswapd", kswapd_run);
+}
+// Set up the frame table at vstart, before kinit2() hands out
+// the memory there.  Returns the first address past it.
+char *frameinit(char *vstart){
+    uint i;
+    initlock(&ftable.lock, "ftable");
+    initsleeplock(&sharers.lock, "sharers");
+    ftable.hand = FIRSTFRAME;
+    ftable.frame = (struct frame *)vstart;
+    memset(ftable.frame, 0, PHYSTOP/PGSIZE * sizeof(struct frame));
+    for(i = 0; i < PHYSTOP/PGSIZE; i++)
+	ftable.frame[i].slot = -1;
+    return (char *)PGROUNDUP((uint)(ftable.frame + PHYSTOP/PGSIZE));
+}
+// Record that p maps the frame at mem at va, or with p == 0,
+// that the frame no longer holds a user page, and so no longer
+// needs its slot.  The frame moves from its old owner's resident
+// ring to the tail of p's.
+static void
+setframe(char *mem, struct proc *p, uint va){
+    uint i = V2P(mem) / PGSIZE;
+    struct frame *f = &ftable.frame[i], *h;
+    struct proc *old = f->owner;
+    if(old){
+	if(f->next == i)
+	    old->rhead = 0;
+	else{
+	    ftable.frame[f->prev].next = f->next;
+	    ftable.frame[f->next].prev = f->prev;
+	    if(old->rhead == i)
+		old->rhead = f->next;
+	}
+	old->rss--;
+    }
+    f->owner = p;
+    f->pgdir = p ? p->pgdir : 0;
+    f->va = va;
+    f->age8 = 0x80;
+    if(p == 0){
+	if(f->slot != -1)
+	    backstore_free(f->slot);
+	f->slot = -1;
+	f->text = 0;
+	return;
+    }
+    if(p->rhead == 0){
+	f->next = f->prev = i;
+	p->rhead = i;
+    }
+    else{
+	h = &ftable.frame[p->rhead];
+	f->next = p->rhead;
+	f->prev = h->prev;
+	ftable.frame[h->prev].next = i;
+	h->prev = i;
+    }
+    p->rss++;
+}
+// The frame at mem is no longer mapped by pgdir.  If pgdir owned
+// it, the frame passes to another process still mapping it, so
+// that it stays where replace_page() and replace_global() look,
+// or is left with no owner if none can take it now.
+static void
+dropframe(char *mem, pde_t *pgdir){
+    struct frame *f = &ftable.frame[V2P(mem) / PGSIZE];
+    struct proc *q;
+    if(f->pgdir != pgdir)
+	return;
+    if(krefcount(mem) > 1 && pageout_mappers(f->owner, f->va, V2P(mem), &q, 1) == 1){
+	setframe(mem, q, f->va);
+	pageout_endn(&q, 1);
+    }
+    else
+	setframe(mem, 0, 0);
+}
+// Allocate a frame for a page fault of currproc, evicting a
+// page if none is free.  While frames are short, a process at
+// its frame target replaces one of its own pages instead of
+// growing.
+char*
+getframe(struct proc *currproc){
+    char *mem;
+    if(currproc->rss >= currproc->target && kfreecount() < kswapd.hiwater &&
+       replace_page(currproc) == 0)
+	direct_pages++;
+    while((mem = kalloc()) == 0){
+	currproc->page_inserted++;
+	if(pcache_shrink() < 0 && replace_page(currproc) < 0 && replace_global() < 0)
+	    panic("out of memory");
+	direct_pages++;
+    }
+    return mem;
+}
+// Handle a write to the copy-on-write page at va.  The page is
+// copied unless no other page table maps it any more, in which
+// case p takes the frame over and it is simply made writable.
+static void
+cow_page(struct proc *p, uint va){
+    pte_t *pte;
+    char *mem, *old;
+    pte = walkpgdir(p->pgdir, (char *)va, 0);
+    old = P2V(PTE_ADDR(*pte));
+    if(krefcount(old) > 1){
+	mem = getframe(p);
+	if(!(*pte & PTE_P) || P2V(PTE_ADDR(*pte)) != old){
+	    // Stopped being shared and was evicted to make room;
+	    // the write will fault again and swap it in.
+	    kfree(mem);
+	    return;
+	}
+	memmove(mem, old, PGSIZE);
+	*pte = V2P(mem) | PTE_ALLOC(*pte) | PTE_FLAGS(*pte) | PTE_W;
+	dropframe(old, p->pgdir);
+	kfree(old);
+	old = mem;
+    }
+    else
+	*pte |= PTE_W;
+    setframe(old, p, va);
+    lcr3(V2P(p->pgdir));
+}
+// Find where p's executable holds its text or data page at va,
+// using the segments exec() recorded.  Sets *off to the offset in
+// the file and returns how many bytes of the page come from it;
+// the rest of the page is zeros.
+static uint
+text_extent(struct proc *p, uint va, uint *off){
+    struct segment *s;
+    uint n;
+    for(s = p->seg; s < &p->seg[p->nseg]; s++){
+	if(va < s->vaddr || va >= s->vaddr + s->memsz)
+	    continue;
+	if(va - s->vaddr >= s->filesz)
+	    return 0;
+	*off = s->off + (va - s->vaddr);
+	n = s->filesz - (va - s->vaddr);
+	return n < PGSIZE ? n : PGSIZE;
+    }
+    return 0;
+}
+// If p's text or data page at va is in the shared page cache,
+// return its frame with a reference taken for p.
+static char*
+cached_text(struct proc *p, uint va){
+    uint off;
+    if(text_extent(p, va, &off) != PGSIZE)
+	return 0;
+    return pcache_get(p->exe, off);
+}
+// Fill mem with p's text or data page at va.  No log transaction
+// is needed just to read the executable.  A page wholly from the
+// file is offered to the shared page cache; returns 1 if it went
+// in, in which case it must be mapped read-only.
+static int
+load_text(struct proc *p, uint va, char *mem){
+    uint off, n;
+    int locked;
+    if((n = text_extent(p, va, &off)) > 0){
+	// The fault may come from read() of the executable itself.
+	if(!(locked = holdingsleep(&p->exe->lock)))
+	    ilock(p->exe);
+	if(readi(p->exe, mem, off, n) != n)
+	    panic("load_text");
+	if(!locked)
+	    iunlock(p->exe);
+    }
+    memset(mem + n, 0, PGSIZE - n);
+    return n == PGSIZE && pcache_put(p->exe, off, mem) == 0;
+}
+// Page-fault frequency: a process faulting again within
+// PFFTICKS needs more frames than it has, so its target grows
+// past its resident set.  sample_proc() shrinks it again.
+static void
+pff_fault(struct proc *p){
+    if(ticks - p->last_fault < PFFTICKS && p->target <= p->rss)
+	p->target = p->rss + 1;
+    p->last_fault = ticks;
+}
 void page_fault_handler(unsigned int fault_addr){
     uint alloc;
     if((uint)fault_addr >= KERNBASE){
@@ -418,122 +987,281 @@ void page_fault_handler(unsigned int fault_addr){
     fault_addr = PGROUNDDOWN(fault_addr);
     struct proc *currproc = myproc();
     currproc->page_fault_count++;
-    struct elfhdr elf;
-    struct proghdr ph;
-    struct inode *ip;
-    int i, off;
+    pte_t *pte;
     char *mem;
-    int loaded = 0;
-    while((mem = kalloc()) == 0){
-	    currproc->page_inserted++;
-	    replace_page(currproc);
+    int slot;
+    vmbusy(1);
+    // User pages are always mapped writable except when shared
+    // copy-on-write, so a fault on a present read-only one is a
+    // write to such a page.
+    pte = walkpgdir(currproc->pgdir, (char *)fault_addr, 0);
+    if(pte && (*pte & (PTE_P | PTE_U | PTE_W)) == (PTE_P | PTE_U)){
+	    cow_page(currproc, fault_addr);
+	    vmbusy(0);
+	    return;
     }
+    ra_resize(currproc, fault_addr);
+    pff_fault(currproc);
     if(currproc->alloc < 8)
 	    (currproc->alloc) += 1;
     alloc = GETALLOC(((currproc->alloc) - 1));
-    if(mappages(currproc->pgdir, (char *)fault_addr, PGSIZE, V2P(mem), PTE_W | PTE_U | PTE_P, alloc) < 0)
-	    panic("mappages");
-    if((fault_addr > currproc->elf_size ||  currproc->code_on_bs) && load_frame(mem, (char *)fault_addr) == 1){
-	    loaded = 1;
-	    loaded++;
+    // Text and data pages shared with other processes running the
+    // same binary are mapped read-only, so writes copy them.
+    if(pte && (*pte & (PTE_P | PTE_SWAP | PTE_ZERO)) == 0 &&
+       (mem = cached_text(currproc, fault_addr)) != 0){
+	    if(mappages(currproc->pgdir, (char *)fault_addr, PGSIZE, V2P(mem), PTE_U | PTE_P, alloc) < 0)
+	        panic("mappages");
+	    vmbusy(0);
+	    return;
+    }
+    mem = getframe(currproc);
+    if(pte && (*pte & (PTE_P | PTE_ZERO)) == PTE_ZERO){
+	    memset(mem, 0, PGSIZE);
+	    if(mappages(currproc->pgdir, (char *)fault_addr, PGSIZE, V2P(mem), PTE_W | PTE_U | PTE_P, alloc) < 0)
+	        panic("mappages");
+	    setframe(mem, currproc, fault_addr);
+    }
+    else if((slot = load_frame(currproc->pgdir, fault_addr, mem)) != -1){
+	    if(mappages(currproc->pgdir, (char *)fault_addr, PGSIZE, V2P(mem), PTE_W | PTE_U | PTE_P, alloc) < 0)
+	        panic("mappages");
+	    setframe(mem, currproc, fault_addr);
+	    ftable.frame[V2P(mem) / PGSIZE].slot = slot;
+	    swapin_ahead(currproc, fault_addr, alloc);
+    }
+    else if(load_text(currproc, fault_addr, mem)){
+	    if(mappages(currproc->pgdir, (char *)fault_addr, PGSIZE, V2P(mem), PTE_U | PTE_P, alloc) < 0)
+	        panic("mappages");
     }
     else{
-	    begin_op();
-	    ip = namei(currproc->path);
-	    if(ip == 0)
-	        panic("Namei path");
-	    ilock(ip);
-	    readi(ip, (char *)&elf, 0, sizeof(elf));
-	    for(i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)){
-	        if(readi(ip, (char *)&ph, off, sizeof(ph)) != sizeof(ph))
-		        panic("Prog header unable to read");
-	        if(ph.vaddr <= fault_addr && fault_addr <= ph.vaddr + ph.memsz){
-		        if(ph.vaddr + ph.filesz >= fault_addr + PGSIZE)
-		            loaduvm(currproc->pgdir, (char *)(ph.vaddr + fault_addr), ip, ph.off + fault_addr, PGSIZE);
-		        else{
-		            if(fault_addr >= ph.filesz){
-			            if(fault_addr + PGSIZE <= ph.memsz)
-			                stosb(mem, 0, PGSIZE);
-			            else
-			                stosb(mem, 0, ph.memsz - fault_addr);
-		            }
-		            else{
-			            loaduvm(currproc->pgdir, (char *)(ph.vaddr + fault_addr), ip, ph.off + fault_addr, ph.filesz - fault_addr);
-			            stosb((mem + (ph.filesz - fault_addr)), 0, PGSIZE - (ph.filesz - fault_addr)); 
-			            ip = namei(currproc->path);
-		            }
-		        }
-	        }
-	    }
-	    iunlockput(ip);
-	    end_op();
+	    if(mappages(currproc->pgdir, (char *)fault_addr, PGSIZE, V2P(mem), PTE_W | PTE_U | PTE_P, alloc) < 0)
+	        panic("mappages");
+	    setframe(mem, currproc, fault_addr);
+	    ftable.frame[V2P(mem) / PGSIZE].text = 1;
     }
+    vmbusy(0);
 }
-void replace_page(struct proc *currproc){
+// Evict one resident page of currproc, which is either the
+// current process or one held by pageout_begin().  The policy
+// picks the victim from currproc's resident ring, whose head
+// serves as the clock hand, so a scan costs time in proportion
+// to the resident set.  Returns 0, or -1 if currproc has no page
+// to evict.
+int replace_page(struct proc *currproc){
+    struct policy *pol = &policies[vmpolicy];
+    struct frame *f;
     pte_t *pte;
-    uint i;
-    uint alloc = 8, pa = 0, min_va = currproc->sz;
-    uint flags;
-    char reach_alloc_max = 0;
-    uint pte_alloc;
-    if(currproc->alloc == 0)
-	    panic("global replacement");
-    else{
-	    for(i = 0; i < (currproc->sz); i += PGSIZE){
-	        if(i == PGROUNDUP(currproc->elf_size))
-		        continue;
-	        if((pte = walkpgdir(currproc->pgdir, (void *)i, 0)) == 0)
-		        panic("page replacement : copyuvm should exist");
-	        if(*pte & (PTE_P)){
-		        pa = PTE_ADDR(*pte);
-		        flags = PTE_FLAGS(*pte);
-		        if(alloc > (PTE_ALLOC(*pte) >> 9)){
-		            alloc =  PTE_ALLOC(*pte) >> 9;
-		            min_va = i;
-		        }
-		        if((uint)(PTE_ALLOC(*pte) >> 9) > 0 ){
-		            pte_alloc = PTE_ALLOC(*pte) >> 9;
-		            if(pte_alloc == 7 ){
-			            if(reach_alloc_max == 0)
-			                reach_alloc_max = 1;
-		            }
-		            *pte = pa |  GETALLOC((pte_alloc - 1)) | flags ;
-		        }
-            }
-	    }
-	    pte = walkpgdir(currproc->pgdir, (void *)min_va, 0);
-	    pa = PTE_ADDR(*pte);
-	    memmove((currproc->buf), (char *)P2V(pa), PGSIZE);
-	    if(store_page(currproc, min_va) == -1)
-		    panic("Backing store size over");
-	    *pte = pa | PTE_W | PTE_U;
-	    char *va = P2V(pa);
-	    currproc->code_on_bs = 1;
-	    kfree(va);
-    }
-}
-int load_frame(char *pa, char *va){
-    struct buf *buff;
-    struct proc *currproc = myproc();
-    int j;
-    struct backstore_frame *temp = currproc->blist;
-    int current_index;
-    uint block_no;
-    while(1){
-	    if((char *)(temp->va) == va){
-	        current_index = ((uint)temp - (uint)(backstore.backstore_bitmap)) / sizeof(struct backstore_frame);
-	        block_no = BACKSTORE_START + current_index * 8;
-	        break;
+    uint n, fi;
+    int pass;
+    for(pass = 0; pass < NPASS; pass++){
+	for(n = currproc->rss, fi = currproc->rhead; n > 0; n--, fi = f->next){
+	    f = &ftable.frame[fi];
+	    if(f->va == PGROUNDUP(currproc->elf_size) || f->pgdir != currproc->pgdir)
+		continue;
+	    if((pte = walkpgdir(currproc->pgdir, (void *)f->va, 0)) == 0 || !(*pte & PTE_P))
+		panic("replace_page: resident ring");
+	    ra_account(pte, 0);
+	    if(pol->pick(pte, f, pass)){
+		currproc->rhead = f->next;
+		if(evict(currproc, f->va) == 0)
+		    return 0;
 	    }
-	    if(temp->next_index == -1)
-	        return -1;
-	    temp = &(backstore.backstore_bitmap[temp->next_index]);
+	}
     }
-    for(j = 0; j < 8; j++){
-	    buff = bread(ROOTDEV, (block_no) + j);
-	    memmove((pa + BSIZE * j), buff->data, BSIZE);
-	    brelse(buff);
+    if(currproc == myproc())
+	lcr3(V2P(currproc->pgdir));  // reload cleared PTE_A bits
+    return -1;
+}
+// Is the page at mem all zeros?  Such a page needs no slot.
+static int
+zeropage(char *mem){
+    uint *w;
+    for(w = (uint *)mem; w < (uint *)(mem + PGSIZE); w++)
+	if(*w)
+	    return 0;
+    return 1;
+}
+// Write p's resident page at va to the backstore and free its
+// frame.  p is the current process or one held by pageout_begin().
+// A page not written since it was swapped in is not written out
+// again: its PTE just goes back to naming the slot.  Likewise an
+// unwritten page of the executable is dropped, to be read from
+// the file at its next fault.  A frame shared copy-on-write is
+// written to one slot that every page table mapping it then
+// names, which needs each of them held; returns -1 if one of
+// them cannot be, else 0.
+static int
+evict(struct proc *p, uint va){
+    struct proc *self, **who = &self;
+    pte_t *pte, **pt = &pte;
+    struct frame *f;
+    uint pa, dirty;
+    int i, n, refs, slot;
+    pte = walkpgdir(p->pgdir, (void *)va, 0);
+    pa = PTE_ADDR(*pte);
+    f = &ftable.frame[pa / PGSIZE];
+    n = 1;
+    if((refs = krefcount(P2V(pa))) > 1){
+	acquiresleep(&sharers.lock);
+	who = sharers.who;
+	pt = sharers.pt;
+	pt[0] = pte;
+	n += pageout_mappers(p, va, pa, who + 1, NPROC - 1);
+	if(n != krefcount(P2V(pa))){  // may have changed while we slept
+	    pageout_endn(who + 1, n - 1);
+	    releasesleep(&sharers.lock);
+	    return -1;
+	}
+    }
+    who[0] = p;
+    dirty = 0;
+    for(i = 0; i < n; i++){
+	if(i > 0)
+	    pt[i] = walkpgdir(who[i]->pgdir, (void *)va, 0);
+	dirty |= *pt[i] & PTE_D;
+	ra_account(pt[i], 1);
+    }
+    if(f->text && !dirty){
+	for(i = 0; i < n; i++)
+	    *pt[i] &= PTE_W | PTE_U;
+	text_dropped++;
+    }
+    else if(f->slot != -1 && !dirty){
+	for(i = 0; i < n; i++){
+	    if(i > 0)
+		backstore_share(f->slot);
+	    *pt[i] = SLOTPTE(f->slot) | PTE_SWAP | (*pt[i] & (PTE_W | PTE_U));
+	}
+	f->slot = -1;
+	swap_clean++;
+    }
+    else if(zeropage(P2V(pa))){
+	for(i = 0; i < n; i++)
+	    *pt[i] = PTE_ZERO | (*pt[i] & (PTE_W | PTE_U));
+    }
+    else if(n == 1){
+	if(f->slot != -1){
+	    // Stale copy; store_page() rewrites it if not shared.
+	    *pt[0] = SLOTPTE(f->slot) | PTE_SWAP | (*pt[0] & (PTE_W | PTE_U));
+	    f->slot = -1;
+	}
+	if(store_page(p->pgdir, va, P2V(pa)) == -1)
+	    panic("Backing store size over");
+	swap_writes++;
+    }
+    else{
+	if(f->slot != -1){
+	    backstore_free(f->slot);  // stale copy
+	    f->slot = -1;
+	}
+	if((slot = backstore_alloc()) == -1)
+	    panic("Backing store size over");
+	backstore_write(slot, P2V(pa));
+	for(i = 0; i < n; i++){
+	    if(i > 0)
+		backstore_share(slot);
+	    *pt[i] = SLOTPTE(slot) | PTE_SWAP | (*pt[i] & (PTE_W | PTE_U));
+	}
+	swap_writes++;
     }
+    for(i = 0; i < n; i++)
+	if(who[i] == myproc())
+	    lcr3(V2P(who[i]->pgdir));  // drop the stale TLB entry
+    setframe(P2V(pa), 0, 0);
+    for(i = 0; i < n; i++)
+	kfree(P2V(pa));
+    if(refs > 1){
+	pageout_endn(who + 1, n - 1);
+	releasesleep(&sharers.lock);
+    }
+    return 0;
+}
+// Evict a page of any process.  The clock hand sweeps the frame
+// table, asking the policy about each user page it passes.  A page is
+// only touched while its owner is the current process or is held
+// by pageout_begin(), and the frame table entry is checked against
+// the owner's PTE once it is held; an owner that cannot be held is
+// passed over for the rest of the call.  Frames of processes within
+// their frame targets are skipped on the first sweep, and shared
+// frames whenever another process mapping them cannot be held.
+// Since the victim may be any sleeping process, a page it touched
+// just before sleeping can be gone when it wakes; kernel code must
+// not touch user memory while holding a spinlock, because faulting
+// the page back in sleeps.
+// Returns 0, or -1 if NPASS sweeps found nothing to evict.
+int replace_global(void){
+    struct policy *pol = &policies[vmpolicy];
+    struct proc *p, *curproc = myproc();
+    struct frame *f;
+    pte_t *pte;
+    uint n, pa, va, nframe = (PHYSTOP - FIRSTFRAME) / PGSIZE;
+    uint sweep;
+    int evicted;
+    acquire(&ftable.lock);
+    sweep = ++ftable.sweeps;
+    release(&ftable.lock);
+    for(n = 0; n < NPASS * nframe; n++){
+	acquire(&ftable.lock);
+	pa = ftable.hand;
+	ftable.hand += PGSIZE;
+	if(ftable.hand >= PHYSTOP)
+	    ftable.hand = FIRSTFRAME;
+	release(&ftable.lock);
+	f = &ftable.frame[pa / PGSIZE];
+	if((p = f->owner) == 0 || (n < nframe && p->rss <= p->target) ||
+	   p->nosweep == sweep)
+	    continue;
+	if(p != curproc && !pageout_begin(p)){
+	    p->nosweep = sweep;  // running or busy; skip its other frames
+	    continue;
+	}
+	va = f->va;
+	evicted = 0;
+	if(f->owner == p && f->pgdir == p->pgdir && va < p->sz &&
+	   (pte = walkpgdir(p->pgdir, (void *)va, 0)) != 0 &&
+	   (*pte & PTE_P) && PTE_ADDR(*pte) == pa){
+	    ra_account(pte, 0);
+	    if(pol->pick(pte, f, n / nframe))
+		evicted = evict(p, va) == 0;
+	}
+	if(p != curproc)
+	    pageout_end(p);
+	if(evicted)
+	    return 0;
+    }
+    if(curproc)
+	lcr3(V2P(curproc->pgdir));  // reload cleared PTE_A bits
+    return -1;
+}
+// If va's page is in the backstore, read it into mem and return
+// its slot, whose reference passes to the caller.  Returns -1 if
+// the page is not in the backstore.
+int load_frame(pde_t *pgdir, uint va, char *mem){
+    pte_t *pte;
+    uint slot;
+    if((pte = walkpgdir(pgdir, (char *)va, 0)) == 0 || (*pte & (PTE_P | PTE_SWAP)) != PTE_SWAP)
+	    return -1;
+    slot = PTE_SLOT(*pte);
+    backstore_read(slot, mem);
+    *pte &= PTE_W | PTE_U;
+    return slot;
+}
+// Write the page at src to va's backstore slot, taking a new
+// slot if va has none or shares it with another process, and
+// leave va's PTE naming the slot.  The caller frees whatever
+// frame held the page.
+int store_page(pde_t *pgdir, uint va, char *src){
+    pte_t *pte;
+    uint slot;
+    if((pte = walkpgdir(pgdir, (char *)va, 0)) == 0)
+	    panic("store_page");
+    if((*pte & (PTE_P | PTE_SWAP)) == PTE_SWAP && backstore_refcount(PTE_SLOT(*pte)) == 1)
+	    slot = PTE_SLOT(*pte);
+    else if((slot = backstore_alloc()) == -1)
+	    return -1;
+    else if((*pte & (PTE_P | PTE_SWAP)) == PTE_SWAP)
+	    backstore_free(PTE_SLOT(*pte));
+    backstore_write(slot, src);
+    *pte = SLOTPTE(slot) | PTE_SWAP | (*pte & (PTE_W | PTE_U));
     return 1;
 }
 //PAGEBREAK!
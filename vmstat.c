@@ -0,0 +1,76 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "vmstat.h"
+
+struct tunable {
+  char *name;
+  int cmd;
+} tunables[] = {
+  { "lowater", VMCTL_LOWATER },
+  { "hiwater", VMCTL_HIWATER },
+  { "policy", VMCTL_POLICY },
+  { "zbudget", VMCTL_ZBUDGET },
+};
+
+char *policies[] = {
+[VMPOLICY_AGE]   "age",
+[VMPOLICY_FIFO]  "fifo",
+[VMPOLICY_CLOCK] "clock",
+[VMPOLICY_AGING] "aging",
+};
+
+// vmstat                print paging statistics and resident sets
+// vmstat name value     set a paging tunable
+int
+main(int argc, char *argv[])
+{
+  struct vmstat st;
+  struct vmproc pst;
+  int i;
+
+  if(argc == 3){
+    for(i = 0; i < sizeof(tunables)/sizeof(tunables[0]); i++)
+      if(strcmp(argv[1], tunables[i].name) == 0)
+        break;
+    if(i == sizeof(tunables)/sizeof(tunables[0]) ||
+       vmctl(tunables[i].cmd, atoi(argv[2])) < 0){
+      printf(2, "vmstat: cannot set %s to %s\n", argv[1], argv[2]);
+      exit();
+    }
+  }
+
+  if(vmstat(&st) < 0){
+    printf(2, "vmstat: failed\n");
+    exit();
+  }
+  printf(1, "swap slots: %d total, %d free\n", st.swap_total, st.swap_free);
+  printf(1, "readahead: %d pages, %d hits, %d wasted\n",
+         st.ra_pages, st.ra_hits, st.ra_wasted);
+  printf(1, "free frames: %d (lowater %d, hiwater %d)\n",
+         st.free_pages, st.lowater, st.hiwater);
+  printf(1, "policy: %d (%s)\n", st.policy, policies[st.policy]);
+  printf(1, "kswapd: %d wakeups, %d pages; direct reclaim: %d pages\n",
+         st.kswapd_wakeups, st.kswapd_pages, st.direct_pages);
+  printf(1, "page-outs: %d written, %d clean, %d text dropped\n",
+         st.swap_writes, st.swap_clean, st.text_dropped);
+  printf(1, "zswap: %d/%d frames, %d pages in %d bytes",
+         st.z_frames, st.z_budget, st.z_pages, st.z_bytes);
+  if(st.z_bytes)
+    printf(1, " (ratio %d.%d)", st.z_pages*4096/st.z_bytes,
+           st.z_pages*40960/st.z_bytes % 10);
+  printf(1, "\n       %d hits, %d misses", st.z_hits, st.z_misses);
+  if(st.z_hits + st.z_misses)
+    printf(1, " (%d%% hit rate)", st.z_hits*100/(st.z_hits + st.z_misses));
+  printf(1, ", %d spilled\n", st.z_spilled);
+  printf(1, "text cache: %d pages, %d hits\n", st.text_pages, st.text_hits);
+  printf(1, "disk: %d requests in %d commands, %d merged, %d past deadline\n",
+         st.io_requests, st.io_commands, st.io_merged, st.io_expired);
+  printf(1, "      queue depth %d, max %d\n", st.io_depth, st.io_maxdepth);
+  printf(1, "pid\trss\ttarget\tfaults\tname\n");
+  for(i = 0; vmproc(i, &pst) == 0; i++)
+    if(pst.pid)
+      printf(1, "%d\t%d\t%d\t%d\t%s\n",
+             pst.pid, pst.rss, pst.target, pst.faults, pst.name);
+  exit();
+}
@@ -0,0 +1,56 @@
+// Paging statistics returned by the vmstat() system call,
+// and paging tunables read and set by vmctl().  vmproc()
+// returns one process's share.
+// Both the kernel and user programs use this header file.
+
+#define VMCTL_LOWATER 1  // kswapd wakes below this many free frames
+#define VMCTL_HIWATER 2  // kswapd evicts until this many are free
+#define VMCTL_POLICY  3  // page-replacement policy, one of:
+
+#define VMPOLICY_AGE   0  // 3-bit software age in the PTE
+#define VMPOLICY_FIFO  1  // first in, first out
+#define VMPOLICY_CLOCK 2  // second chance on the accessed bit
+#define VMPOLICY_AGING 3  // 8-bit accessed-bit history, sampled
+
+#define VMCTL_ZBUDGET 4  // frames compressed swap may use
+
+struct vmstat {
+  uint swap_total;     // backstore slots, one page each
+  uint swap_free;      // backstore slots not holding a page
+  uint ra_pages;       // pages swapped in ahead of a page fault
+  uint ra_hits;        // ... and then used
+  uint ra_wasted;      // ... and then evicted or freed unused
+  uint free_pages;     // physical frames on the free list
+  uint lowater;        // see VMCTL_LOWATER
+  uint hiwater;        // see VMCTL_HIWATER
+  uint kswapd_wakeups; // times the page-out daemon went to work
+  uint kswapd_pages;   // pages evicted by the page-out daemon
+  uint direct_pages;   // pages evicted by faulting processes
+  uint swap_writes;    // evicted pages written to the backstore
+  uint swap_clean;     // evicted pages still clean in their slot, not written
+  uint text_dropped;   // evicted executable pages, to be read from the file again
+  uint policy;         // see VMCTL_POLICY
+  uint z_budget;       // see VMCTL_ZBUDGET
+  uint z_frames;       // frames compressed swap is using
+  uint z_pages;        // pages held compressed
+  uint z_bytes;        // ... and their compressed size
+  uint z_hits;         // swap-ins served from compressed swap
+  uint z_misses;       // swap-ins read from disk
+  uint z_spilled;      // page-outs sent to disk, pool full or page incompressible
+  uint io_requests;    // disk requests
+  uint io_commands;    // disk commands they took
+  uint io_merged;      // requests merged into another's command
+  uint io_expired;     // commands started out of order for a late request
+  uint io_depth;       // requests waiting for the disk
+  uint io_maxdepth;    // ... at most
+  uint text_pages;     // executable pages in the shared page cache
+  uint text_hits;      // page faults satisfied from it
+};
+
+struct vmproc {
+  int pid;             // 0 if the process table slot is unused
+  char name[16];
+  uint rss;            // resident pages
+  uint target;         // resident pages it should get under pressure
+  uint faults;         // page faults since its last exec
+};
@@ -0,0 +1,322 @@
+// Compressed swap.
+//
+// Pages on their way to the backstore are first compressed into a
+// pool of frames kept in memory; only a page that does not fit,
+// because the pool has used up its budget of frames or because
+// the page does not compress to 3/4 of its size, goes to disk.
+// A page is still given a backstore slot either way, and the pool
+// is indexed by slot, so the rest of the paging code never knows
+// where a slot's contents actually live.
+//
+// Each pool frame is cut into ZCHUNK-byte chunks; a compressed
+// page takes a run of chunks within one frame.  A frame goes back
+// to kalloc() as soon as its last page is dropped.
+//
+// The compressor is a plain LZSS: a flag byte says which of the
+// next eight items are literals and which are back-references,
+// found through a hash of the next three bytes.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "vmstat.h"
+
+#define ZCHUNK     128                // allocation unit within a pool frame
+#define ZNCHUNK    (PGSIZE / ZCHUNK)  // chunks per frame; one bit each in used[]
+#define ZMAXSIZE   (PGSIZE / 4 * 3)   // largest compressed page kept
+
+// A map entry packs the pool frame, first chunk and chunk count
+// of a slot's compressed copy.  0 means the slot is not in the pool.
+#define ZENTRY(pg, start, n)  (((pg) + 1) << 16 | (start) << 8 | (n))
+#define ZPAGE(e)   (((e) >> 16) - 1)
+#define ZSTART(e)  (((e) >> 8) & 0xFF)
+#define ZLEN(e)    ((e) & 0xFF)
+
+#define MINMATCH   3
+#define MAXMATCH   (MINMATCH + 15 + 255)
+#define HASHBITS   12
+#define HASH(p)    ((((p)[0] << 8 ^ (p)[1] << 4 ^ (p)[2]) * 2654435761u) >> (32 - HASHBITS))
+
+struct {
+  struct spinlock lock;
+  uint *map;                 // nslots entries, see ZENTRY
+  uint nslots;               // slots in the backstore
+  char *page[ZMAXPAGES];     // pool frames, 0 if unused
+  uint used[ZMAXPAGES];      // chunks in use in each pool frame
+  uint npages;
+  uint budget;               // most frames the pool may hold
+  ushort hash[1 << HASHBITS];  // compressor: last position + 1 per hash
+  uchar buf[ZMAXSIZE];       // compressor output
+  uint stored;               // pages in the pool
+  uint chunks;               // chunks they occupy
+  uint hits;
+  uint misses;
+  uint spilled;
+} zswap;
+
+// Set up the map for nslots backstore slots at vstart, before
+// kinit2() hands out the memory there.  Returns the first address
+// past it.
+char*
+zswapinit(char *vstart, uint nslots)
+{
+  initlock(&zswap.lock, "zswap");
+  zswap.budget = ZBUDGET;
+  zswap.nslots = nslots;
+  zswap.map = (uint*)vstart;
+  memset(zswap.map, 0, nslots * sizeof(uint));
+  return (char*)PGROUNDUP((uint)(zswap.map + nslots));
+}
+
+// Compress the page at src into dst.  Returns the compressed
+// size, or -1 if it would be more than max bytes.
+static int
+lz_compress(uchar *src, uchar *dst, int max)
+{
+  uchar *flag;
+  uint i, j, n, h, len, off, bit;
+
+  memset(zswap.hash, 0, sizeof(zswap.hash));
+  flag = 0;
+  n = 0;
+  bit = 8;
+  for(i = 0; i < PGSIZE; bit++){
+    if(bit == 8){
+      if(n >= max)
+        return -1;
+      flag = &dst[n++];
+      *flag = 0;
+      bit = 0;
+    }
+    len = 0;
+    j = 0;
+    if(i + MINMATCH <= PGSIZE){
+      h = HASH(src + i);
+      j = zswap.hash[h];
+      zswap.hash[h] = i + 1;
+      if(j-- > 0)
+        while(len < MAXMATCH && i + len < PGSIZE && src[j + len] == src[i + len])
+          len++;
+    }
+    if(len >= MINMATCH){
+      if(n + 3 > max)
+        return -1;
+      off = i - j - 1;
+      len -= MINMATCH;
+      dst[n++] = off;
+      dst[n++] = (off >> 8) << 4 | (len < 15 ? len : 15);
+      if(len >= 15)
+        dst[n++] = len - 15;
+      *flag |= 1 << bit;
+      i += len + MINMATCH;
+    } else {
+      if(n >= max)
+        return -1;
+      dst[n++] = src[i++];
+    }
+  }
+  return n;
+}
+
+// Expand n bytes at src, written by lz_compress(), into the page
+// at dst.  Returns -1 if the data is malformed.
+static int
+lz_decompress(uchar *src, uint n, uchar *dst)
+{
+  uint i, o, flag, bit, off, len;
+
+  flag = 0;
+  i = o = 0;
+  for(bit = 8; o < PGSIZE; bit++){
+    if(bit == 8){
+      if(i >= n)
+        return -1;
+      flag = src[i++];
+      bit = 0;
+    }
+    if(flag & (1 << bit)){
+      if(i + 2 > n)
+        return -1;
+      off = (src[i] | (src[i+1] >> 4) << 8) + 1;
+      len = (src[i+1] & 15) + MINMATCH;
+      i += 2;
+      if(len == 15 + MINMATCH){
+        if(i >= n)
+          return -1;
+        len += src[i++];
+      }
+      if(off > o || o + len > PGSIZE)
+        return -1;
+      for(; len > 0; len--, o++)
+        dst[o] = dst[o - off];
+    } else {
+      if(i >= n)
+        return -1;
+      dst[o++] = src[i++];
+    }
+  }
+  return 0;
+}
+
+// Find a run of n free chunks in some pool frame.
+static int
+zfit(uint n, uint *pg, uint *start)
+{
+  uint p, s, mask;
+
+  for(p = 0; p < ZMAXPAGES; p++){
+    if(zswap.page[p] == 0)
+      continue;
+    mask = (1 << n) - 1;
+    for(s = 0; s + n <= ZNCHUNK; s++, mask <<= 1){
+      if((zswap.used[p] & mask) == 0){
+        *pg = p;
+        *start = s;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Drop slot's compressed copy, if any.  Caller holds zswap.lock.
+static void
+zdrop(uint slot)
+{
+  uint e, p;
+
+  if((e = zswap.map[slot]) == 0)
+    return;
+  zswap.map[slot] = 0;
+  p = ZPAGE(e);
+  zswap.used[p] &= ~(((1 << ZLEN(e)) - 1) << ZSTART(e));
+  zswap.stored--;
+  zswap.chunks -= ZLEN(e);
+  if(zswap.used[p] == 0){
+    kfree(zswap.page[p]);
+    zswap.page[p] = 0;
+    zswap.npages--;
+  }
+}
+
+// Keep a compressed copy of the page at src as slot's contents.
+// Returns 0 if the pool took it, -1 if it must go to disk.
+int
+zswap_store(uint slot, char *src)
+{
+  char *spare;
+  uint p, n, start;
+  int size;
+
+  if(slot >= zswap.nslots)
+    panic("zswap_store");
+  spare = 0;
+  acquire(&zswap.lock);
+  zdrop(slot);
+  for(;;){
+    if((size = lz_compress((uchar*)src, zswap.buf, ZMAXSIZE)) < 0)
+      break;
+    n = (size + ZCHUNK - 1) / ZCHUNK;
+    if(zfit(n, &p, &start)){
+      memmove(zswap.page[p] + start * ZCHUNK, zswap.buf, size);
+      zswap.used[p] |= ((1 << n) - 1) << start;
+      zswap.map[slot] = ZENTRY(p, start, n);
+      zswap.stored++;
+      zswap.chunks += n;
+      release(&zswap.lock);
+      if(spare)
+        kfree(spare);
+      return 0;
+    }
+    if(zswap.npages >= zswap.budget)
+      break;
+    if(spare){
+      for(p = 0; zswap.page[p]; p++)
+        ;
+      zswap.page[p] = spare;
+      zswap.used[p] = 0;
+      zswap.npages++;
+      spare = 0;
+      continue;
+    }
+    // kalloc() may take ptable.lock to wake kswapd, so call it
+    // without zswap.lock; the page is compressed again after.
+    release(&zswap.lock);
+    spare = kalloc();
+    acquire(&zswap.lock);
+    if(spare == 0)
+      break;
+  }
+  zswap.spilled++;
+  release(&zswap.lock);
+  if(spare)
+    kfree(spare);
+  return -1;
+}
+
+// Copy slot's contents into the page at dst if the pool has them.
+// Returns 0 if it did, -1 if they must be read from disk.
+int
+zswap_load(uint slot, char *dst)
+{
+  uint e;
+
+  if(slot >= zswap.nslots)
+    panic("zswap_load");
+  acquire(&zswap.lock);
+  if((e = zswap.map[slot]) == 0){
+    zswap.misses++;
+    release(&zswap.lock);
+    return -1;
+  }
+  if(lz_decompress((uchar*)zswap.page[ZPAGE(e)] + ZSTART(e) * ZCHUNK,
+                   ZLEN(e) * ZCHUNK, (uchar*)dst) < 0)
+    panic("zswap_load: bad data");
+  zswap.hits++;
+  release(&zswap.lock);
+  return 0;
+}
+
+// The backstore has freed slot.
+void
+zswap_drop(uint slot)
+{
+  acquire(&zswap.lock);
+  zdrop(slot);
+  release(&zswap.lock);
+}
+
+// Read or set the pool's budget of frames; a negative val only
+// reads it.  Lowering it keeps pages already in the pool until
+// their slots are freed.  Returns the old value, or -1 if val is
+// too large.
+int
+zswap_budget(int val)
+{
+  uint old;
+
+  if(val > ZMAXPAGES)
+    return -1;
+  acquire(&zswap.lock);
+  old = zswap.budget;
+  if(val >= 0)
+    zswap.budget = val;
+  release(&zswap.lock);
+  return old;
+}
+
+void
+zswap_stat(struct vmstat *st)
+{
+  acquire(&zswap.lock);
+  st->z_budget = zswap.budget;
+  st->z_frames = zswap.npages;
+  st->z_pages = zswap.stored;
+  st->z_bytes = zswap.chunks * ZCHUNK;
+  st->z_hits = zswap.hits;
+  st->z_misses = zswap.misses;
+  st->z_spilled = zswap.spilled;
+  release(&zswap.lock);
+}